@@ -0,0 +1,163 @@
+// No Copyright. Vladislav Aleinik 2019
+#include "Domain.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// Same gas run in slabs over ranks forked on this machine and in one model,
+// molecules of both are compared at the end. Bouncy gases shift only one molecule of a pair
+// in one model and both by half across slabs, so there the deepest overlap left is compared.
+
+const size_t    MOLECULES = 2000;
+const PhysVal_t BOX_X     = 1500;
+const PhysVal_t BOX_YZ    = 300;
+
+// Two molecules in collision right on the first slab boundary are added to the random ones
+std::vector<Molecule> makeGas(size_t ranks)
+{
+	std::mt19937 gen{7};
+	std::normal_distribution<PhysVal_t>       speeds{0, 0.3};
+	std::uniform_real_distribution<PhysVal_t> coordsX{0, BOX_X};
+	std::uniform_real_distribution<PhysVal_t> coordsYZ{0, BOX_YZ};
+
+	std::vector<Molecule> gas;
+	for (size_t i = 0; i < MOLECULES; ++i)
+	{
+		Vector coord = {coordsX(gen), coordsYZ(gen), coordsYZ(gen)};
+		Vector speed = {speeds(gen), speeds(gen), speeds(gen)};
+
+		gas.push_back(Molecule(coord, speed, (i % 2)? ARGON : HELIUM));
+	}
+
+	PhysVal_t boundary = BOX_X / ranks;
+	gas.push_back(Molecule({boundary - 0.1, BOX_YZ / 2, BOX_YZ / 2}, {0, 0, 0}, HELIUM));
+	gas.push_back(Molecule({boundary + 0.1, BOX_YZ / 2, BOX_YZ / 2}, {0, 0, 0}, HELIUM));
+
+	return gas;
+}
+
+// Molecules carry no ids, both sides are sorted by coordinates
+bool coordsLess(const Molecule& a, const Molecule& b)
+{
+	if (a.coords.x != b.coords.x) return a.coords.x < b.coords.x;
+	if (a.coords.y != b.coords.y) return a.coords.y < b.coords.y;
+	return a.coords.z < b.coords.z;
+}
+
+PhysVal_t distance(const Vector& a, const Vector& b)
+{
+	return std::sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z));
+}
+
+// Largest amount by which two molecules are closer than their collision radii sum
+PhysVal_t deepestOverlap(const std::vector<Molecule>& gas)
+{
+	PhysVal_t deepest = 0.0;
+	for (size_t i = 0; i < gas.size(); ++i)
+	{
+		for (size_t j = i + 1; j < gas.size(); ++j)
+		{
+			PhysVal_t radiusSum = COLLISION_RADIUS[gas[i].type] + COLLISION_RADIUS[gas[j].type];
+			deepest = std::fmax(deepest, radiusSum - distance(gas[i].coords, gas[j].coords));
+		}
+	}
+
+	return deepest;
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Every rank runs its slab, rank 0 runs the single model as well
+int compare(Transport* transport, GasType gasType, const char* gasName, size_t steps)
+{
+	std::vector<Molecule> gas = makeGas(transport->rankCount());
+
+	SlabDomain domain(transport, {BOX_X, BOX_YZ, BOX_YZ}, 1, gasType);
+	domain.model.setNeighborSearch(VERLET_LIST_SEARCH);
+
+	for (const Molecule& mol : gas)
+		domain.addMolecule(mol);
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t step = 0; step < steps; ++step)
+		domain.iterationCycle();
+	double domainTime = millisecondsSince(start);
+
+	std::vector<Molecule> gathered = domain.gatherMolecules();
+
+	if (transport->rank() != 0) return 0;
+
+	GasModel model({BOX_X, BOX_YZ, BOX_YZ}, 1, gasType);
+	model.setNeighborSearch(VERLET_LIST_SEARCH);
+
+	for (const Molecule& mol : gas)
+		model.addMolecule(mol);
+
+	start = std::chrono::steady_clock::now();
+	for (size_t step = 0; step < steps; ++step)
+		model.iterationCycle();
+	double modelTime = millisecondsSince(start);
+
+	if (gathered.size() != model.moleculeCount)
+	{
+		printf("%s gas: slabs hold %zu molecules, the model %zu\n", gasName, gathered.size(), model.moleculeCount);
+		return 1;
+	}
+
+	std::vector<Molecule> single(model.molecules, model.molecules + model.moleculeCount);
+	std::sort(gathered.begin(), gathered.end(), coordsLess);
+	std::sort(single  .begin(), single  .end(), coordsLess);
+
+	printf("%s gas, %zu slabs: %.2f ms/step, one model: %.2f ms/step\n",
+	       gasName, transport->rankCount(), domainTime / steps, modelTime / steps);
+
+	// One molecule placed otherwise throws the sorted order off, only overlaps are compared:
+	if (gasType == BOUNCY_GAS)
+	{
+		printf("Deepest overlap left: %.3e in slabs, %.3e in one model\n", deepestOverlap(gathered), deepestOverlap(single));
+		return 0;
+	}
+
+	PhysVal_t maxCoordDiff = 0.0;
+	PhysVal_t maxSpeedDiff = 0.0;
+	for (size_t i = 0; i < single.size(); ++i)
+	{
+		maxCoordDiff = std::fmax(maxCoordDiff, distance(gathered[i].coords, single[i].coords));
+		maxSpeedDiff = std::fmax(maxSpeedDiff, distance(gathered[i].speed,  single[i].speed));
+	}
+
+	printf("After %zu steps the molecules differ by at most %.3e in coordinates and %.3e in speeds\n",
+	       steps, maxCoordDiff, maxSpeedDiff);
+
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 3)
+	{
+		printf("Expected the rank count and the step count\n");
+		return 1;
+	}
+
+	size_t ranks = std::stoul(argv[1]);
+	size_t steps = std::stoul(argv[2]);
+
+	// Forked before any thread is started:
+	Transport* transport = SocketTransport::forkLocal(ranks);
+
+	// All ranks take part in both runs:
+	int potential = compare(transport, POTENTIAL_GAS, "Potential", steps);
+	int bouncy    = compare(transport, BOUNCY_GAS,    "Bouncy",    steps);
+
+	delete transport;
+	return potential | bouncy;
+}
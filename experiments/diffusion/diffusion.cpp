@@ -1,39 +1,108 @@
 // No Copyright. Vladislav Aleinik 2019
 #include "Model.hpp"
-#include "SavingToFile.hpp"
-#include "cnpy.h"
+#include "Trajectory.hpp"
 
-#include <valarray>
-#include <numeric>
+#include <cmath>
 #include <random>
+#include <thread>
+#include <vector>
 
 
 const PhysVal_t TEMPERATURE      = 300/*K*/;
-const size_t    MOLECULES        = MAX_NUMBER_OF_MOLECULES;
+const size_t    MOLECULES        = 50000;
 const size_t    ITERATIONS       = 100000;
 const size_t    SAVE_FRAME_EVERY = 100;
 const size_t    SAVE_DATA_EVERY  = 100;
 const size_t    BIN_COUNT        = 10;
 const size_t    FIX_T_EVERY      = 100; 
 
+const PhysVal_t ACTUAL_BOX_SIZE_X  = 1e4;
+const PhysVal_t ACTUAL_BOX_SIZE_YZ = 2e3;
+const PhysVal_t ACTUAL_BOX_VOLUME  = ACTUAL_BOX_SIZE_X * ACTUAL_BOX_SIZE_YZ * ACTUAL_BOX_SIZE_YZ;
+
+// Concentrations of every gas along x, fluxes through the borders of the bins since the previous observation
+// and gradients across them. Bins of every gas go one after another in all three files.
+class DiffusionObserver : public HistogramObserver
+{
+public:
+	DiffusionObserver(PhysVal_t boxSizeX, const char* concentrationsPath, const char* fluxesPath, const char* gradientsPath) :
+		HistogramObserver(0, boxSizeX, BIN_COUNT),
+		concentrations (concentrationsPath, 1 + TYPES_COUNT *  BIN_COUNT),
+		fluxes         (fluxesPath,         1 + TYPES_COUNT * (BIN_COUNT - 1)),
+		gradients      (gradientsPath,      1 + TYPES_COUNT * (BIN_COUNT - 1)),
+		prevCounts     (),
+		row            (TYPES_COUNT * BIN_COUNT)
+	{}
+
+	void observe(const GasModel& model, const PhysVal_t* sums) override
+	{
+		HistogramObserver::observe(model, sums);
+
+		// Bringing data back to normal dimensions
+		for (size_t i = 0; i < TYPES_COUNT * BIN_COUNT; ++i)
+			row[i] = counts[i] / ACTUAL_BOX_VOLUME;
+
+		concentrations.writeRow(model.iteration, row.data());
+
+		for (size_t type = 0; type < TYPES_COUNT; ++type)
+		{
+			const PhysVal_t* cur = &counts[type * BIN_COUNT];
+
+			for (size_t gradI = 0; gradI < BIN_COUNT-1; ++gradI)
+				row[type * (BIN_COUNT-1) + gradI] = (cur[gradI+1] - cur[gradI]) /
+				                                    ((ACTUAL_BOX_VOLUME / BIN_COUNT) * (ACTUAL_BOX_SIZE_X / BIN_COUNT));
+		}
+
+		gradients.writeRow(model.iteration, row.data());
+
+		// Fluxes need the previous observation
+		if (!prevCounts.empty())
+		{
+			for (size_t type = 0; type < TYPES_COUNT; ++type)
+			{
+				const PhysVal_t* cur = &    counts[type * BIN_COUNT];
+				const PhysVal_t* prv = &prevCounts[type * BIN_COUNT];
+
+				for (size_t fluxI = 0; fluxI < BIN_COUNT-1; ++fluxI)
+				{
+					PhysVal_t flux = 0.0;
+					for (size_t binJ = fluxI+1; binJ < BIN_COUNT; ++binJ)
+						flux += cur[binJ] - prv[binJ];
+
+					row[type * (BIN_COUNT-1) + fluxI] = flux / (std::pow(ACTUAL_BOX_SIZE_YZ, 2) * (TIME_DELTA * SAVE_DATA_EVERY));
+				}
+			}
+
+			fluxes.writeRow(model.iteration, row.data());
+		}
+
+		prevCounts = counts;
+	}
+
+private:
+	ObservationFile concentrations;
+	ObservationFile fluxes;
+	ObservationFile gradients;
+
+	std::vector<PhysVal_t> prevCounts;
+	std::vector<PhysVal_t> row;
+};
+
 int main(int argc, char* argv[])
 {
-	if (argc != 10)
+	if (argc != 5)
 	{
 		printf("DIFFUSION: Wrong arguments\n");
-		printf("Call pattern: diffusion <.npy coords> <.npy speeds> <.npy mol types> "
-		       "<.csv concHe> <.csv concAr> <.npy fluxHe> <.npy fluxAr> "
-		       "<.npy gradsHe> <.npy gradsAr>\n");
+		printf("Call pattern: diffusion <.traj trajectory> "
+		       "<.obs concentrations> <.obs fluxes> <.obs gradients>\n");
 		return 1;
 	}
 
 	// Model
-	const PhysVal_t ACTUAL_BOX_SIZE_X  = 1e4;
-	const PhysVal_t ACTUAL_BOX_SIZE_YZ = 2e3;
-	const PhysVal_t ACTUAL_BOX_VOLUME  = ACTUAL_BOX_SIZE_X * std::pow(ACTUAL_BOX_SIZE_YZ, 2);
 	const PhysVal_t BOX_SIZE_X  = SAS_2_Model(ACTUAL_BOX_SIZE_X , 0, 1, 0);
 	const PhysVal_t BOX_SIZE_YZ = SAS_2_Model(ACTUAL_BOX_SIZE_YZ, 0, 1, 0);
-	GasModel model = GasModel({BOX_SIZE_X, BOX_SIZE_YZ, BOX_SIZE_YZ});
+	GasModel model = GasModel({BOX_SIZE_X, BOX_SIZE_YZ, BOX_SIZE_YZ}, std::thread::hardware_concurrency());
+	model.setNeighborSearch(VERLET_LIST_SEARCH);
 
 	// Generating speeds and coordinates:
 	std::random_device rd;
@@ -70,32 +139,11 @@ int main(int argc, char* argv[])
 	}
 
 	// Saving data
-	DataSaver saver{MOLECULES};
-	saver.writeMoleculeTypes(model, argv[3]);
-
-	FILE* concentrationsHeHandle = fopen(argv[4], "w");
-	if (concentrationsHeHandle == nullptr)
-	{
-		printf("DIFFUSION: Unable to open file \'%s\'\n", argv[4]);
-	}
-
-	FILE* concentrationsArHandle = fopen(argv[5], "w");
-	if (concentrationsArHandle == nullptr)
-	{
-		printf("DIFFUSION: Unable to open file \'%s\'\n", argv[4]);
-	}
+	TrajectoryWriter trajectory{argv[1], model};
 
-	// Stuff to analyse diffusion:
-	auto countsHeCur = std::valarray<long>(BIN_COUNT);
-	auto countsHePrv = std::valarray<long>(BIN_COUNT);
-	auto countsArCur = std::valarray<long>(BIN_COUNT);
-	auto countsArPrv = std::valarray<long>(BIN_COUNT);
-
-	auto fluxesHe = std::valarray<PhysVal_t>(BIN_COUNT - 1);
-	auto fluxesAr = std::valarray<PhysVal_t>(BIN_COUNT - 1);
-
-	auto gradsHe = std::valarray<PhysVal_t>(BIN_COUNT - 1);
-	auto gradsAr = std::valarray<PhysVal_t>(BIN_COUNT - 1);
+	// Analysing diffusion as the model goes
+	DiffusionObserver diffusion{BOX_SIZE_X, argv[2], argv[3], argv[4]};
+	model.addObserver(&diffusion, SAVE_DATA_EVERY);
 
 	// THE SIMULATION
 	for (size_t iter = 0; iter <= ITERATIONS; ++iter)
@@ -112,76 +160,10 @@ int main(int argc, char* argv[])
 		model.iterationCycle();
 
 		if (iter % SAVE_FRAME_EVERY == 0)
-			saver.writeFrame(model, argv[1], argv[2]);
-
-		if (iter % SAVE_DATA_EVERY == 0)
-		{
-			// Filling arrays
-			countsHePrv = countsHeCur;
-			countsArPrv = countsArCur;
-
-			countsHeCur = 0;
-			countsArCur = 0;
-
-			for (size_t mol = 0; mol < MOLECULES; ++mol)
-			{
-				size_t index = lround(floor(10 * model.molecules[mol].coords.x / BOX_SIZE_X)) % 10;
-
-				if (model.molecules[mol].type == HELIUM) countsHeCur[index] += 1;
-				else                                     countsArCur[index] += 1;
-			}
-
-			fluxesHe = 0.0;
-			fluxesAr = 0.0;
-
-			for (size_t fluxI = 0; fluxI < BIN_COUNT-1; ++fluxI)
-			{
-				for (size_t binJ = fluxI+1; binJ < BIN_COUNT; ++binJ)
-				{
-					fluxesHe[fluxI] += countsHeCur[binJ] - countsHePrv[binJ];
-					fluxesAr[fluxI] += countsArCur[binJ] - countsArPrv[binJ];
-				}
-
-				gradsHe[fluxI] = countsHeCur[fluxI+1] - countsHeCur[fluxI];
-				gradsAr[fluxI] = countsArCur[fluxI+1] - countsArCur[fluxI];
-			}
-
-			// Bringing data back to normal dimensions
-			fluxesHe /= std::pow(ACTUAL_BOX_SIZE_YZ, 2) * (TIME_DELTA * SAVE_DATA_EVERY);
-			fluxesAr /= std::pow(ACTUAL_BOX_SIZE_YZ, 2) * (TIME_DELTA * SAVE_DATA_EVERY);
-
-			gradsHe /= (ACTUAL_BOX_VOLUME / BIN_COUNT) * (ACTUAL_BOX_SIZE_X / BIN_COUNT);
-			gradsAr /= (ACTUAL_BOX_VOLUME / BIN_COUNT) * (ACTUAL_BOX_SIZE_X / BIN_COUNT);
-
-			// Saving stuff to file
-			for (size_t i = 0; i < BIN_COUNT; ++i)
-			{
-				if (i != 0)
-				{
-					fprintf(concentrationsHeHandle, ", ");
-					fprintf(concentrationsArHandle, ", ");
-				}
-
-				fprintf(concentrationsHeHandle, "%e", countsHeCur[i] / ACTUAL_BOX_VOLUME);
-				fprintf(concentrationsArHandle, "%e", countsArCur[i] / ACTUAL_BOX_VOLUME);
-
-			}
-
-			fprintf(concentrationsHeHandle, "\n");
-			fprintf(concentrationsArHandle, "\n");
-
-			if (iter != 0)
-			{
-				cnpy::npy_save(argv[6], &fluxesHe[0], {BIN_COUNT-1}, "a");
-				cnpy::npy_save(argv[7], &fluxesAr[0], {BIN_COUNT-1}, "a");
-				cnpy::npy_save(argv[8],  &gradsHe[0], {BIN_COUNT-1}, "a");
-				cnpy::npy_save(argv[9],  &gradsAr[0], {BIN_COUNT-1}, "a");
-			}
-		}
+			trajectory.writeFrame(model);
 	}
 
-	fclose(concentrationsHeHandle);
-	fclose(concentrationsArHandle);
+	model.removeObserver(&diffusion);
 
 	printf("\n");
 
@@ -1,10 +1,9 @@
 // No Copyright. Maxim Manainen 2019
 #include "Model.hpp"
 #include "Dimensioning.hpp"
-#include "cnpy.h"
 
+#include <iostream>
 #include <random>
-#include <vector>
 
 int prog_bar(int done, int whole) {
 	std::cout << "\rPercent: " << done << "/" << whole;
@@ -39,29 +38,20 @@ int main(int argc, char * argv[]) {
 		model.addMolecule(Molecule(coord, speed, MoleculeType::HELIUM));
 	}
 
-	std::vector<PhysVal_t> res;
-
 	int num_steps    = std::stoi(argv[2]);
 	int display_step = std::stoi(argv[3]);
 
+	// Kinetic and potential energy every display_step steps, summed while the model sweeps the molecules
+	EnergyObserver energy{"experiments/energy/energy.obs"};
+	model.addObserver(&energy, display_step);
+
 	for (int i = 0; i < num_steps; ++i)
 	{
 		model.iterationCycle();
 
-		if (i % display_step == 0) {
-
-			PhysVal_t speed = 0;
-
-			for (size_t j = 0; j < num_molecules; ++j)
-				speed += model.molecules[j].speed.lenSqr();
-			res.push_back( speed / 2 );
-
+		if (i % display_step == 0)
 			prog_bar(i, num_steps);
-		}
 	}
 
-	long unsigned int size = num_steps / display_step;
-
-	cnpy::npy_save("experiments/energy/kinetic.npy", &res[0], {1, size}, "w");
-
+	model.removeObserver(&energy);
 }
@@ -1,32 +1,40 @@
 // No Copyright. Vladislav Aleinik 2019
 #include "Model.hpp"
-#include "SavingToFile.hpp"
+#include "Trajectory.hpp"
 
 #include <random>
 #include <chrono>
 
+#include <unistd.h>
+
 #include <fenv.h>
 
 const size_t MOLECULES        = 20000;
 const size_t ITERATIONS       = 10000;
 const size_t SAVE_FRAME_EVERY = 5; 
 const size_t FIX_T_EVERY      = 100;
+const size_t CHECKPOINT_EVERY = 1000;
 
 int main(int argc, char* argv[])  
 {
-	if (argc != 4)
+	if (argc != 2 && argc != 3)
 	{
 		printf("MODEL: Not enough arguments\n");
-		printf("Call pattern: model <.npy coordinates> <.npy velocities> <.npy molecule types>\n");
+		printf("Call pattern: model <.traj trajectory> [<checkpoint>]\n");
 		return 1;
 	}
 
+	// A run with a checkpoint left from before goes on from it:
+	const char* checkpoint = (argc == 3)? argv[2] : nullptr;
+	bool resuming = checkpoint && access(checkpoint, F_OK) == 0;
+
 	// Model
 	const PhysVal_t BOX_SIZE = SAS_2_Model(2e2, 0, 1, 0);
 	GasModel model = GasModel({BOX_SIZE, BOX_SIZE, BOX_SIZE});
 
-	// A bit of code that saves model to file
-	DataSaver saver{MOLECULES};
+	// Dense liquid: uniform cells beat the tree
+	model.setNeighborSearch(CELL_LIST_SEARCH);
+	model.setMoleculeLayout(STRUCT_OF_ARRAYS);
 
 	// Generating speeds from a distribution:
 	std::random_device rd;
@@ -42,24 +50,32 @@ int main(int argc, char* argv[])
 	std::uniform_real_distribution<PhysVal_t> coordsXY{0.0, BOX_SIZE};
 
 	// Filling array of molecules
-	for (size_t i = 0; i < MOLECULES; ++i)
+	if (resuming) model.loadCheckpoint(checkpoint, &gen);
+	else
 	{
-		Vector speed = Vector(speeds  (gen), speeds  (gen), speeds (gen));
-		Vector coord = Vector(coordsXY(gen), coordsXY(gen), coordsZ(gen));
+		for (size_t i = 0; i < MOLECULES; ++i)
+		{
+			Vector speed = Vector(speeds  (gen), speeds  (gen), speeds (gen));
+			Vector coord = Vector(coordsXY(gen), coordsXY(gen), coordsZ(gen));
 
-		model.addMolecule(Molecule(coord, speed, MoleculeType::HELIUM));
+			model.addMolecule(Molecule(coord, speed, MoleculeType::HELIUM));
+		}
 	}
 
-	// Write molecule types to file
-	saver.writeMoleculeTypes(model, argv[3]);
+	// Molecule types go to the file with it, frames saved after the checkpoint are dropped:
+	TrajectoryWriter trajectory{argv[1], model, DEFAULT_TRAJECTORY_CAPACITY, resuming? RESUME_TRAJECTORY : CREATE_TRAJECTORY};
 
 	// Init timers
 	std::chrono::steady_clock clock{};
 	auto begin = clock.now();
 
 	// THE SIMULATION
-	for (size_t iter = 0; iter < ITERATIONS; ++iter)  
+	size_t firstIter = model.iteration;
+	for (size_t iter = firstIter; iter < ITERATIONS; ++iter)  
 	{
+		if (checkpoint && iter % CHECKPOINT_EVERY == 0 && iter != firstIter)
+			model.saveCheckpoint(checkpoint, &gen);
+
 		if (iter % FIX_T_EVERY == 0)
 			model.fixEnergy();
 
@@ -68,7 +84,7 @@ int main(int argc, char* argv[])
 			printf("\r[MODEL] %03zu%%", 100*iter/ITERATIONS);
 			std::fflush(stdout);
 
-			saver.writeFrame(model, argv[1], argv[2]);
+			trajectory.writeFrame(model);
 		}
 
 		model.iterationCycle();
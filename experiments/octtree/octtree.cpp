@@ -0,0 +1,80 @@
+// No Copyright. Vladislav Aleinik 2019
+#include "Model.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// Tight pairs of molecules make the tree far deeper than two nodes per molecule,
+// so it has to grow past what the model reserved both when built and when refitted.
+// The refitted tree has to give the same molecules as the rebuilt one. The cell list
+// visits pairs in another order, so it only matches until the first collisions.
+
+const size_t    PAIRS         = 2000;
+const PhysVal_t PAIR_DISTANCE = 5e-3;
+const PhysVal_t BOX_SIZE      = 1000;
+
+std::vector<Molecule> makePairs()
+{
+	std::mt19937 gen{5};
+	std::uniform_real_distribution<PhysVal_t> coords{10, BOX_SIZE - 10};
+	std::uniform_real_distribution<PhysVal_t> speeds{-1, 1};
+
+	std::vector<Molecule> gas;
+	for (size_t i = 0; i < PAIRS; ++i)
+	{
+		Vector coord = {coords(gen), coords(gen), coords(gen)};
+
+		gas.push_back(Molecule(coord,                                        {speeds(gen), speeds(gen), speeds(gen)}, HELIUM));
+		gas.push_back(Molecule({coord.x + PAIR_DISTANCE, coord.y, coord.z}, {speeds(gen), speeds(gen), speeds(gen)}, HELIUM));
+	}
+
+	return gas;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 2)
+	{
+		printf("Expected the step count\n");
+		return 1;
+	}
+
+	size_t steps = std::stoul(argv[1]);
+
+	std::vector<Molecule> gas = makePairs();
+	std::vector<Molecule> reference;
+
+	const char* names[3] = {"rebuilt tree", "refitted tree", "cell list"};
+	for (size_t run = 0; run < 3; ++run)
+	{
+		// Only as much room as the molecules need, the tree starts at two nodes per molecule:
+		GasModel model({BOX_SIZE, BOX_SIZE, BOX_SIZE}, 1, BOUNCY_GAS, gas.size());
+		model.setNeighborSearch((run == 2)? CELL_LIST_SEARCH : OCT_TREE_SEARCH);
+		if (run == 1) model.setOctTreeUpdate(REFIT_OCT_TREE);
+
+		for (const Molecule& mol : gas)
+			model.addMolecule(mol);
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t step = 0; step < steps; ++step)
+			model.iterationCycle();
+		double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		if (run == 0) reference.assign(model.molecules, model.molecules + model.moleculeCount);
+
+		PhysVal_t maxDiff = 0.0;
+		for (size_t i = 0; i < model.moleculeCount; ++i)
+		{
+			const Vector& a = model.molecules[i].coords;
+			const Vector& b = reference[i].coords;
+
+			maxDiff = std::fmax(maxDiff, std::sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z)));
+		}
+
+		printf("%-13s %.2f ms/step, %zu tree nodes for %zu molecules, differs from the rebuilt tree by %.3e\n",
+		       names[run], time / steps, model.octTreeSize, model.moleculeCount, maxDiff);
+	}
+}
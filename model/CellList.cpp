@@ -0,0 +1,165 @@
+// No Copyright. Vladislav Aleinik 2019
+#include "CellList.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+// Cells beyond this many per molecule are almost all empty and only slow the sort down
+const size_t MAX_CELLS_PER_MOLECULE = 2;
+
+CellList::CellList(Vector newBoxSize, PhysVal_t newMinCellSize) :
+	boxSize          (newBoxSize),
+	minCellSize      (newMinCellSize),
+	period           (std::numeric_limits<PhysVal_t>::infinity(),
+	                  std::numeric_limits<PhysVal_t>::infinity(),
+	                  std::numeric_limits<PhysVal_t>::infinity()),
+	cellCounts       {1, 1, 1},
+	cellCount        (0),
+	cellSize         (newBoxSize),
+	cellStarts       (nullptr),
+	cellMolecules    (nullptr),
+	moleculeCapacity (0)
+{}
+
+CellList::~CellList()
+{
+	delete[] cellStarts;
+	delete[] cellMolecules;
+}
+
+void CellList::setPeriod(const Vector& newPeriod)
+{
+	period = newPeriod;
+}
+
+// Arrays are only reallocated when the cells change or the molecules outgrow them,
+// so that molecules added or removed one at a time do not free them every build
+void CellList::layoutCells(size_t moleculeCount)
+{
+	PhysVal_t boxSizes[3] = {boxSize.x, boxSize.y, boxSize.z};
+	size_t prevCellCount  = cellCount;
+
+	for (size_t axis = 0; axis < 3; ++axis)
+	{
+		cellCounts[axis] = (boxSizes[axis] < 2 * minCellSize)? 1 : std::floor(boxSizes[axis] / minCellSize);
+	}
+
+	while (cellCounts[0] * cellCounts[1] * cellCounts[2] > MAX_CELLS_PER_MOLECULE * moleculeCount + 1)
+	{
+		size_t widest = 0;
+		for (size_t axis = 1; axis < 3; ++axis)
+		{
+			if (cellCounts[axis] > cellCounts[widest]) widest = axis;
+		}
+
+		if (cellCounts[widest] == 1) break;
+		cellCounts[widest] /= 2;
+	}
+
+	cellCount = cellCounts[0] * cellCounts[1] * cellCounts[2];
+	cellSize  = Vector(boxSizes[0] / cellCounts[0], boxSizes[1] / cellCounts[1], boxSizes[2] / cellCounts[2]);
+
+	if (cellStarts == nullptr || cellCount != prevCellCount)
+	{
+		delete[] cellStarts;
+		cellStarts = new size_t[cellCount + 1];
+	}
+
+	if (cellMolecules == nullptr || moleculeCount > moleculeCapacity)
+	{
+		delete[] cellMolecules;
+		moleculeCapacity = moleculeCount + moleculeCount / 4;
+		cellMolecules    = new size_t[moleculeCapacity];
+	}
+
+	if (!cellStarts || !cellMolecules)
+	{
+		printf("CellList::layoutCells(): Unable to allocate memory!\n");
+		exit(1);
+	}
+}
+
+size_t cellCoordinate(PhysVal_t coord, PhysVal_t cellSize, size_t cellCount)
+{
+	if (coord <= 0.0) return 0;
+
+	size_t cell = coord / cellSize;
+	return (cell < cellCount)? cell : cellCount - 1;
+}
+
+size_t CellList::cellOf(const Vector& coords) const
+{
+	return (cellCoordinate(coords.x, cellSize.x, cellCounts[0])  * cellCounts[1] +
+	        cellCoordinate(coords.y, cellSize.y, cellCounts[1])) * cellCounts[2] +
+	        cellCoordinate(coords.z, cellSize.z, cellCounts[2]);
+}
+
+void CellList::build(const Molecule* molecules, size_t moleculeCount)
+{
+	// Cells depend on the molecule count, laying them out is a handful of divisions:
+	layoutCells(moleculeCount);
+
+	for (size_t cellI = 0; cellI <= cellCount; ++cellI)
+		cellStarts[cellI] = 0;
+
+	for (size_t i = 0; i < moleculeCount; ++i)
+		cellStarts[cellOf(molecules[i].coords) + 1] += 1;
+
+	for (size_t cellI = 0; cellI < cellCount; ++cellI)
+		cellStarts[cellI + 1] += cellStarts[cellI];
+
+	for (size_t i = 0; i < moleculeCount; ++i)
+		cellMolecules[cellStarts[cellOf(molecules[i].coords)]++] = i;
+
+	// Filling shifted every start one cell forward:
+	for (size_t cellI = cellCount; cellI > 0; --cellI)
+		cellStarts[cellI] = cellStarts[cellI - 1];
+	cellStarts[0] = 0;
+}
+
+template<typename Func>
+inline void CellList::forEachNeighbor(const Molecule* molecules, size_t moleculeI, size_t ownCount, Func func) const
+{
+	const Vector& coords = molecules[moleculeI].coords;
+
+	size_t cell[3] = {cellCoordinate(coords.x, cellSize.x, cellCounts[0]),
+	                  cellCoordinate(coords.y, cellSize.y, cellCounts[1]),
+	                  cellCoordinate(coords.z, cellSize.z, cellCounts[2])};
+
+	bool periodic[3] = {std::isfinite(period.x), std::isfinite(period.y), std::isfinite(period.z)};
+
+	// Neighbor cells along every axis, from below to above. Wrapped ones are taken once,
+	// since an axis of one or two cells has fewer to offer.
+	size_t around[3][3] = {}, aroundCounts[3];
+	for (size_t axis = 0; axis < 3; ++axis)
+	{
+		aroundCounts[axis] = 0;
+
+		for (size_t offset = 0; offset < 3; ++offset)
+		{
+			size_t neighbor = cell[axis] + offset + cellCounts[axis] - 1;
+			if (!periodic[axis] && (neighbor < cellCounts[axis] || neighbor >= 2 * cellCounts[axis])) continue;
+			neighbor %= cellCounts[axis];
+
+			bool seen = false;
+			for (size_t i = 0; i < aroundCounts[axis]; ++i)
+				seen |= around[axis][i] == neighbor;
+
+			if (!seen) around[axis][aroundCounts[axis]++] = neighbor;
+		}
+	}
+
+	for (size_t xI = 0; xI < aroundCounts[0]; ++xI)
+	for (size_t yI = 0; yI < aroundCounts[1]; ++yI)
+	for (size_t zI = 0; zI < aroundCounts[2]; ++zI)
+	{
+		size_t cellI = (around[0][xI] * cellCounts[1] + around[1][yI]) * cellCounts[2] + around[2][zI];
+
+		for (size_t i = cellStarts[cellI]; i < cellStarts[cellI + 1]; ++i)
+		{
+			if (visitsPair(moleculeI, cellMolecules[i], ownCount)) func(cellMolecules[i]);
+		}
+	}
+}
@@ -0,0 +1,47 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef GAS_MODEL_CELL_LIST_HPP_INCLUDED
+#define GAS_MODEL_CELL_LIST_HPP_INCLUDED
+
+#include "Molecule.hpp"
+
+#include <cstddef>
+
+// Uniform grid of cells not smaller than the interaction range.
+// All partners of a molecule lie in its own cell and the 26 cells around it,
+// which wrap around the periodic axes.
+class CellList
+{
+public:
+	CellList(Vector boxSize, PhysVal_t minCellSize);
+	~CellList();
+
+	// Counting sort of molecules into cells
+	void build(const Molecule* molecules, size_t moleculeCount);
+
+	size_t cellOf(const Vector& coords) const;
+
+	// Periods as in GasContainer, infinite along walls:
+	void setPeriod(const Vector& newPeriod);
+
+	// Calls func(partnerI) for every molecule in the 27 cells around moleculeI, moleculeI itself excluded
+	template<typename Func>
+	inline void forEachNeighbor(const Molecule* molecules, size_t moleculeI, size_t ownCount, Func func) const;
+
+	Vector boxSize;
+	PhysVal_t minCellSize;
+	Vector period;
+
+	size_t cellCounts[3];
+	size_t cellCount;
+	Vector cellSize;
+
+	// Molecules of cell c are cellMolecules[cellStarts[c] .. cellStarts[c + 1])
+	size_t* cellStarts;
+	size_t* cellMolecules;
+	size_t  moleculeCapacity;
+
+private:
+	void layoutCells(size_t moleculeCount);
+};
+
+#endif  // GAS_MODEL_CELL_LIST_HPP_INCLUDED
@@ -0,0 +1,60 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef GAS_MODEL_CHECKPOINT_HPP_INCLUDED
+#define GAS_MODEL_CHECKPOINT_HPP_INCLUDED
+
+#include "Molecule.hpp"
+
+#include <cstdint>
+
+//==============================================
+// CHECKPOINT FILE
+//==============================================
+// [header                                       ]
+// [molecules, moleculeCount raw Molecule structs]
+// [forces, moleculeCount raw Vectors, if any    ]
+// [state of the caller's generator, as text     ]
+//
+// Molecules and forces are dumped as they lie in
+// memory, so a checkpoint only restores into the
+// build that wrote it. The sizes of both structs
+// are kept in the header to tell that apart.
+//==============================================
+
+const char     CHECKPOINT_MAGIC[8] = "GASCKPT";
+const uint32_t CHECKPOINT_VERSION  = 1;
+
+struct CheckpointHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t gasType;
+	uint32_t moleculeBytes;
+	uint32_t vectorBytes;
+	uint64_t moleculeCount;
+	uint64_t forceCount;
+	uint64_t generatorBytes;
+
+	// Box:
+	PhysVal_t boxSize[3];
+	uint32_t boundaries[3];
+
+	// Multiple time stepping:
+	uint32_t outerShellSteps;
+	uint64_t outerShellStart;
+	PhysVal_t innerShellRadius;
+	AttractionShell attractionShell;
+	PhysVal_t outerPotentialEnergy;
+
+	// Energy fix-up:
+	uint32_t prevTotalEnergyCalculated;
+	uint32_t sweptEnergyValid;
+	PhysVal_t prevTotalEnergy;
+	PhysVal_t currPotentialEnergy;
+	PhysVal_t sweptKineticEnergy;
+	PhysVal_t sweptGravityEnergy;
+	PhysVal_t pendingSpeedScale;
+
+	uint64_t iteration;
+};
+
+#endif // GAS_MODEL_CHECKPOINT_HPP_INCLUDED
\ No newline at end of file
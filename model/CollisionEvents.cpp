@@ -0,0 +1,297 @@
+// No Copyright. Vladislav Aleinik 2019
+#include "CollisionEvents.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+const PhysVal_t NEVER = std::numeric_limits<PhysVal_t>::infinity();
+
+// Heap comparator, the earliest event goes on top
+inline bool laterEvent(const CollisionEvent& a, const CollisionEvent& b)
+{
+	return a.time > b.time;
+}
+
+inline PhysVal_t axisOf(const Vector& vec, size_t axis)
+{
+	return (axis == 0)? vec.x : (axis == 1)? vec.y : vec.z;
+}
+
+inline PhysVal_t& axisOf(Vector& vec, size_t axis)
+{
+	return (axis == 0)? vec.x : (axis == 1)? vec.y : vec.z;
+}
+
+// Cells are only used to find partners, so no smaller than the largest collision diameter
+CollisionEvents::CollisionEvents(Vector boxSize) :
+	collisionCount    (0),
+	wallHitCount      (0),
+	cellCrossingCount (0),
+	staleEventCount   (0),
+	box               (boxSize),
+	grid              (boxSize, 2 * MAXIMUM_COLLISION_RADIUS),
+	valid             (false),
+	builtCount        (0),
+	now               (0.0),
+	events            (),
+	times             (),
+	eventCounts       (),
+	cellCoords        (),
+	cellHeads         (),
+	cellNext          (),
+	cellPrev          ()
+{}
+
+void CollisionEvents::invalidate()
+{
+	valid = false;
+}
+
+//==============================================
+// CELLS
+//==============================================
+
+void CollisionEvents::insertIntoCell(size_t moleculeI)
+{
+	size_t cellI = (cellCoords[3 * moleculeI] * grid.cellCounts[1] + cellCoords[3 * moleculeI + 1]) * grid.cellCounts[2] +
+	                cellCoords[3 * moleculeI + 2];
+
+	cellPrev[moleculeI] = -1;
+	cellNext[moleculeI] = cellHeads[cellI];
+
+	if (cellHeads[cellI] != -1) cellPrev[cellHeads[cellI]] = moleculeI;
+	cellHeads[cellI] = moleculeI;
+}
+
+void CollisionEvents::removeFromCell(size_t moleculeI)
+{
+	size_t cellI = (cellCoords[3 * moleculeI] * grid.cellCounts[1] + cellCoords[3 * moleculeI + 1]) * grid.cellCounts[2] +
+	                cellCoords[3 * moleculeI + 2];
+
+	if (cellPrev[moleculeI] != -1) cellNext[cellPrev[moleculeI]] = cellNext[moleculeI];
+	else                           cellHeads[cellI]              = cellNext[moleculeI];
+
+	if (cellNext[moleculeI] != -1) cellPrev[cellNext[moleculeI]] = cellPrev[moleculeI];
+}
+
+//==============================================
+// PREDICTION
+//==============================================
+
+void CollisionEvents::moveToTime(Molecule& mol, size_t moleculeI, PhysVal_t time)
+{
+	mol.coords += mol.speed * (time - times[moleculeI]);
+	times[moleculeI] = time;
+}
+
+void CollisionEvents::pushEvent(const CollisionEvent& event)
+{
+	events.push_back(event);
+	std::push_heap(events.begin(), events.end(), laterEvent);
+}
+
+// The earliest of the wall hits and cell crossings is pushed, then every collision before it.
+// Collisions after it are predicted again once the molecule gets there.
+void CollisionEvents::predict(const Molecule* molecules, size_t moleculeI)
+{
+	const Molecule& mol = molecules[moleculeI];
+	PhysVal_t radius = COLLISION_RADIUS[mol.type];
+
+	Vector coords = mol.coords + mol.speed * (now - times[moleculeI]);
+
+	CollisionEvent solo = {NEVER, static_cast<uint32_t>(moleculeI), 0, eventCounts[moleculeI], 0, WALL_HIT, 0};
+	for (size_t axis = 0; axis < 3; ++axis)
+	{
+		PhysVal_t speed = axisOf(mol.speed, axis);
+		if (speed == 0.0) continue;
+
+		PhysVal_t coord    = axisOf(coords, axis);
+		PhysVal_t size     = axisOf(box.containerSize, axis);
+		PhysVal_t cellSize = axisOf(grid.cellSize, axis);
+		uint32_t  cell     = cellCoords[3 * moleculeI + axis];
+
+		PhysVal_t wall = (speed > 0)? size - radius : radius;
+		PhysVal_t wallTime = now + std::max<PhysVal_t>(0.0, (wall - coord) / speed);
+		if (wallTime < solo.time) solo = {wallTime, solo.molA, 0, solo.eventsA, 0, WALL_HIT, static_cast<uint8_t>(axis)};
+
+		// Outer faces of the grid are never crossed:
+		bool edge = (speed > 0)? cell + 1 == grid.cellCounts[axis] : cell == 0;
+		if (edge) continue;
+
+		PhysVal_t face = (speed > 0)? (cell + 1) * cellSize : cell * cellSize;
+		PhysVal_t crossTime = now + std::max<PhysVal_t>(0.0, (face - coord) / speed);
+		if (crossTime < solo.time) solo = {crossTime, solo.molA, 0, solo.eventsA, 0, CELL_CROSSING, static_cast<uint8_t>(axis)};
+	}
+
+	if (solo.time != NEVER) pushEvent(solo);
+
+	uint32_t lo[3], hi[3];
+	for (size_t axis = 0; axis < 3; ++axis)
+	{
+		uint32_t cell = cellCoords[3 * moleculeI + axis];
+
+		lo[axis] = (cell == 0)? 0 : cell - 1;
+		hi[axis] = (cell + 1 == grid.cellCounts[axis])? cell : cell + 1;
+	}
+
+	for (uint32_t x = lo[0]; x <= hi[0]; ++x)
+	for (uint32_t y = lo[1]; y <= hi[1]; ++y)
+	for (uint32_t z = lo[2]; z <= hi[2]; ++z)
+	{
+		for (int partnerI = cellHeads[(x * grid.cellCounts[1] + y) * grid.cellCounts[2] + z]; partnerI != -1;
+		     partnerI = cellNext[partnerI])
+		{
+			if (static_cast<size_t>(partnerI) == moleculeI) continue;
+
+			const Molecule& partner = molecules[partnerI];
+
+			Vector    coordDiff = coords - (partner.coords + partner.speed * (now - times[partnerI]));
+			Vector    speedDiff = mol.speed - partner.speed;
+			PhysVal_t approach  = coordDiff.scalar(speedDiff);
+
+			// Only approaching molecules collide:
+			if (approach >= 0.0) continue;
+
+			PhysVal_t radiusSum    = radius + COLLISION_RADIUS[partner.type];
+			PhysVal_t gapSqr       = coordDiff.lenSqr() - radiusSum * radiusSum;
+			PhysVal_t speedSqr     = speedDiff.lenSqr();
+			PhysVal_t discriminant = approach * approach - speedSqr * gapSqr;
+			if (discriminant < 0.0) continue;
+
+			// The root nearest to now, overlapping molecules collide at once:
+			PhysVal_t time = now + ((gapSqr <= 0.0)? 0.0 : gapSqr / (-approach + std::sqrt(discriminant)));
+			if (time > solo.time) continue;
+
+			pushEvent({time, static_cast<uint32_t>(moleculeI), static_cast<uint32_t>(partnerI),
+			           eventCounts[moleculeI], eventCounts[partnerI], MOLECULE_COLLISION, 0});
+		}
+	}
+}
+
+void CollisionEvents::reset(const Molecule* molecules, size_t moleculeCount)
+{
+	grid.build(molecules, moleculeCount);
+
+	events.clear();
+
+	// Events are predicted anew, so the clock starts over and its rounding does not depend on the past:
+	now = 0.0;
+
+	times      .assign(moleculeCount, now);
+	eventCounts.assign(moleculeCount, 0);
+	cellCoords .assign(3 * moleculeCount, 0);
+	cellHeads  .assign(grid.cellCount, -1);
+	cellNext   .assign(moleculeCount, -1);
+	cellPrev   .assign(moleculeCount, -1);
+
+	for (size_t i = 0; i < moleculeCount; ++i)
+	{
+		for (size_t axis = 0; axis < 3; ++axis)
+		{
+			cellCoords[3 * i + axis] = cellCoordinate(axisOf(molecules[i].coords, axis), axisOf(grid.cellSize, axis),
+			                                          grid.cellCounts[axis]);
+		}
+
+		insertIntoCell(i);
+	}
+
+	for (size_t i = 0; i < moleculeCount; ++i)
+		predict(molecules, i);
+
+	builtCount = moleculeCount;
+	valid      = true;
+}
+
+//==============================================
+// EVENT LOOP
+//==============================================
+
+void CollisionEvents::advance(Molecule* molecules, size_t moleculeCount, PhysVal_t duration)
+{
+	if (!valid || moleculeCount != builtCount) reset(molecules, moleculeCount);
+
+	PhysVal_t endTime = now + duration;
+
+	while (!events.empty() && events.front().time <= endTime)
+	{
+		std::pop_heap(events.begin(), events.end(), laterEvent);
+		CollisionEvent event = events.back();
+		events.pop_back();
+
+		if (event.eventsA != eventCounts[event.molA] ||
+		    (event.kind == MOLECULE_COLLISION && event.eventsB != eventCounts[event.molB]))
+		{
+			++staleEventCount;
+			continue;
+		}
+
+		now = event.time;
+
+		Molecule& molA = molecules[event.molA];
+		moveToTime(molA, event.molA, now);
+
+		if (event.kind == MOLECULE_COLLISION)
+		{
+			Molecule& molB = molecules[event.molB];
+			moveToTime(molB, event.molB, now);
+
+			// Same exchange as moleculesCollide, with the molecules exactly in contact:
+			Vector coordDiff = molA.coords - molB.coords;
+			Vector speedDiffProj = coordDiff * (coordDiff.scalar(molA.speed - molB.speed) / coordDiff.lenSqr());
+
+			molA.speed -= speedDiffProj;
+			molB.speed += speedDiffProj;
+
+			++eventCounts[event.molA];
+			++eventCounts[event.molB];
+			++collisionCount;
+
+			predict(molecules, event.molA);
+			predict(molecules, event.molB);
+		}
+		else if (event.kind == WALL_HIT)
+		{
+			PhysVal_t radius = COLLISION_RADIUS[molA.type];
+			PhysVal_t& speed = axisOf(molA.speed, event.axis);
+
+			// Put right on the wall, so that rounding never carries the molecule through:
+			axisOf(molA.coords, event.axis) = (speed > 0)? axisOf(box.containerSize, event.axis) - radius : radius;
+			speed *= -1;
+
+			++eventCounts[event.molA];
+			++wallHitCount;
+
+			predict(molecules, event.molA);
+		}
+		else
+		{
+			removeFromCell(event.molA);
+
+			uint32_t& cell = cellCoords[3 * event.molA + event.axis];
+			if (axisOf(molA.speed, event.axis) > 0) ++cell;
+			else                                    --cell;
+
+			insertIntoCell(event.molA);
+			++cellCrossingCount;
+
+			predict(molecules, event.molA);
+		}
+	}
+
+	now = endTime;
+	for (size_t i = 0; i < moleculeCount; ++i)
+		moveToTime(molecules[i], i, now);
+}
+
+// Time left until every event shrinks by the factor, a monotone change keeps the heap in order
+void CollisionEvents::scaleSpeeds(Molecule* molecules, size_t moleculeCount, PhysVal_t factor)
+{
+	for (size_t i = 0; i < moleculeCount; ++i)
+		molecules[i].speed *= factor;
+
+	if (!valid || moleculeCount != builtCount) return;
+
+	for (CollisionEvent& event : events)
+		event.time = now + (event.time - now) / factor;
+}
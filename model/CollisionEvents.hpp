@@ -0,0 +1,92 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef GAS_MODEL_COLLISION_EVENTS_HPP_INCLUDED
+#define GAS_MODEL_COLLISION_EVENTS_HPP_INCLUDED
+
+#include "CellList.hpp"
+#include "Walls.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//==============================================
+// EVENT-DRIVEN HARD SPHERES
+//==============================================
+// Molecules fly straight between events, so the
+// exact times of collisions, wall hits and cell
+// crossings are predicted and handled one by one
+// in time order. Every molecule is only moved to
+// the time of its own last event, all of them are
+// brought to the end of the step together.
+// Time is counted in steps.
+//==============================================
+
+enum CollisionEventKind
+{
+	MOLECULE_COLLISION = 0,
+	WALL_HIT           = 1,
+	CELL_CROSSING      = 2
+};
+
+// An event is stale once any of its molecules has had a collision or a wall hit after its prediction
+struct CollisionEvent
+{
+	PhysVal_t time;
+	uint32_t molA;
+	uint32_t molB;
+	uint32_t eventsA;
+	uint32_t eventsB;
+	uint8_t kind;
+	uint8_t axis;
+};
+
+class CollisionEvents
+{
+public:
+	CollisionEvents(Vector boxSize);
+
+	// Predicts everything anew from the current positions
+	void reset(const Molecule* molecules, size_t moleculeCount);
+	void invalidate();
+
+	// Handles all events within the duration and moves every molecule to its end
+	void advance(Molecule* molecules, size_t moleculeCount, PhysVal_t duration);
+
+	// Event times follow scaled speeds, the molecules have to be at the current time
+	void scaleSpeeds(Molecule* molecules, size_t moleculeCount, PhysVal_t factor);
+
+	size_t collisionCount;
+	size_t wallHitCount;
+	size_t cellCrossingCount;
+	size_t staleEventCount;
+
+private:
+	void moveToTime(Molecule& mol, size_t moleculeI, PhysVal_t time);
+	void pushEvent(const CollisionEvent& event);
+	void predict(const Molecule* molecules, size_t moleculeI);
+
+	void insertIntoCell(size_t moleculeI);
+	void removeFromCell(size_t moleculeI);
+
+	GasContainer box;
+	CellList grid;
+
+	bool valid;
+	size_t builtCount;
+	PhysVal_t now;
+
+	// Heap ordered by time, earliest first:
+	std::vector<CollisionEvent> events;
+
+	// Time each molecule's coordinates are valid at and its collisions and wall hits so far:
+	std::vector<PhysVal_t> times;
+	std::vector<uint32_t> eventCounts;
+
+	// Cell coordinates of every molecule and doubly-linked molecule lists of every cell:
+	std::vector<uint32_t> cellCoords;
+	std::vector<int> cellHeads;
+	std::vector<int> cellNext;
+	std::vector<int> cellPrev;
+};
+
+#endif  // GAS_MODEL_COLLISION_EVENTS_HPP_INCLUDED
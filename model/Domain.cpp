@@ -0,0 +1,312 @@
+// No Copyright. Vladislav Aleinik 2019
+#include "Domain.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+SlabDomain::SlabDomain(Transport* newTransport, Vector boxSize, size_t threads, GasType gas, size_t capacity) :
+	model          (boxSize, threads, gas, capacity),
+	transport      (newTransport),
+	slabFirst      (boxSize.x *  transport->rank()      / transport->rankCount()),
+	slabLast       (boxSize.x * (transport->rank() + 1) / transport->rankCount()),
+	// Ghosts have to cover the interaction range after both sides make a step:
+	haloWidth      (model.interactionRange + 2 * MAXIMUM_COLLISION_RADIUS),
+	toLeft         (),
+	toRight        (),
+	received       (),
+	exchanged      (false),
+	ghostsLeft     (),
+	ghostsRight    (),
+	exchangeCoords ()
+{}
+
+bool SlabDomain::ownsMolecule(const Molecule& mol) const
+{
+	bool first = transport->rank() == 0;
+	bool last  = transport->rank() == transport->rankCount() - 1;
+
+	return (first || slabFirst <= mol.coords.x) && (last || mol.coords.x < slabLast);
+}
+
+// Own molecules go before the ghosts
+void SlabDomain::addMolecule(Molecule mol)
+{
+	if (!ownsMolecule(mol)) return;
+
+	model.removeGhostMolecules();
+	model.addMolecule(mol);
+
+	exchanged = false;
+}
+
+//==============================================
+// MESSAGES
+//==============================================
+
+void SlabDomain::sendParcels(size_t toRank, const std::vector<MoleculeParcel>& parcels)
+{
+	uint64_t count = parcels.size();
+	transport->send(toRank, &count, sizeof(count));
+	transport->send(toRank, parcels.data(), count * sizeof(MoleculeParcel));
+}
+
+// Received parcels are appended
+void SlabDomain::receiveParcels(size_t fromRank, std::vector<MoleculeParcel>& parcels)
+{
+	uint64_t count = 0;
+	transport->receive(fromRank, &count, sizeof(count));
+
+	size_t first = parcels.size();
+	parcels.resize(first + count);
+	transport->receive(fromRank, parcels.data() + first, count * sizeof(MoleculeParcel));
+}
+
+// Pairs (0, 1), (2, 3), ... talk first, then pairs (1, 2), (3, 4), ...
+// Every rank is in one pair at a time and the lower rank of a pair sends first, so nobody waits in a cycle.
+void SlabDomain::exchangeWithNeighbors(const std::vector<MoleculeParcel>& leftParcels,
+                                       const std::vector<MoleculeParcel>& rightParcels,
+                                       std::vector<MoleculeParcel>& receivedParcels)
+{
+	size_t rank = transport->rank();
+
+	for (size_t phase = 0; phase < 2; ++phase)
+	{
+		if (rank % 2 == phase)
+		{
+			if (rank + 1 == transport->rankCount()) continue;
+
+			sendParcels   (rank + 1, rightParcels);
+			receiveParcels(rank + 1, receivedParcels);
+		}
+		else
+		{
+			if (rank == 0) continue;
+
+			receiveParcels(rank - 1, receivedParcels);
+			sendParcels   (rank - 1, leftParcels);
+		}
+	}
+}
+
+// Rank 0 sums in rank order and hands the sums back, so all ranks get the same bits
+void SlabDomain::sumOverRanks(PhysVal_t* values, size_t count)
+{
+	if (transport->rank() != 0)
+	{
+		transport->send   (0, values, count * sizeof(PhysVal_t));
+		transport->receive(0, values, count * sizeof(PhysVal_t));
+		return;
+	}
+
+	std::vector<PhysVal_t> other(count);
+	for (size_t rank = 1; rank < transport->rankCount(); ++rank)
+	{
+		transport->receive(rank, other.data(), count * sizeof(PhysVal_t));
+
+		for (size_t i = 0; i < count; ++i)
+			values[i] += other[i];
+	}
+
+	for (size_t rank = 1; rank < transport->rankCount(); ++rank)
+		transport->send(rank, values, count * sizeof(PhysVal_t));
+}
+
+//==============================================
+// HALOS AND MIGRATION
+//==============================================
+
+// Ranks have to agree, as the neighbors exchange all or refresh all
+bool SlabDomain::needsExchange()
+{
+	PhysVal_t halfSkin = model.neighborList->skin / 2;
+	PhysVal_t moved    = exchanged? 0.0 : 1.0;
+
+	for (size_t i = 0; i < model.moleculeCount - model.ghostCount && moved == 0.0; ++i)
+	{
+		if ((model.molecules[i].coords - exchangeCoords[i]).lenSqr() > halfSkin * halfSkin) moved = 1.0;
+	}
+
+	sumOverRanks(&moved, 1);
+
+	return moved != 0.0;
+}
+
+// Ghosts come with their forces, so they make the same integration step as on their owner
+void SlabDomain::packGhosts()
+{
+	toLeft  .clear();
+	toRight .clear();
+	received.clear();
+
+	for (size_t i : ghostsLeft)
+		toLeft .push_back({model.molecules[i], model.forces? model.forces[i] : Vector(0, 0, 0)});
+	for (size_t i : ghostsRight)
+		toRight.push_back({model.molecules[i], model.forces? model.forces[i] : Vector(0, 0, 0)});
+}
+
+// Ghosts reach over the halo and the skin, as own molecules may come closer by half the skin from either side
+void SlabDomain::exchangeGhosts()
+{
+	PhysVal_t ghostRange = haloWidth + model.neighborList->skin;
+
+	ghostsLeft .clear();
+	ghostsRight.clear();
+	exchangeCoords.resize(model.moleculeCount);
+
+	for (size_t i = 0; i < model.moleculeCount; ++i)
+	{
+		exchangeCoords[i] = model.molecules[i].coords;
+
+		if (model.molecules[i].coords.x < slabFirst + ghostRange) ghostsLeft .push_back(i);
+		if (model.molecules[i].coords.x >= slabLast - ghostRange) ghostsRight.push_back(i);
+	}
+
+	packGhosts();
+	exchangeWithNeighbors(toLeft, toRight, received);
+
+	for (const MoleculeParcel& parcel : received)
+		model.addGhostMolecule(parcel.mol, parcel.force);
+
+	exchanged = true;
+}
+
+// Same molecules in the same order as at the last exchange
+void SlabDomain::refreshGhosts()
+{
+	packGhosts();
+	exchangeWithNeighbors(toLeft, toRight, received);
+
+	if (received.size() != model.ghostCount)
+	{
+		printf("SlabDomain::refreshGhosts(): Neighbors sent %zu ghosts instead of %zu\n", received.size(), model.ghostCount);
+		exit(1);
+	}
+
+	for (size_t ghostI = 0; ghostI < received.size(); ++ghostI)
+		model.refreshGhostMolecule(ghostI, received[ghostI].mol, received[ghostI].force);
+}
+
+void SlabDomain::migrateMolecules()
+{
+	toLeft  .clear();
+	toRight .clear();
+	received.clear();
+
+	// Going down, the molecule moved into a freed place has already been looked at:
+	for (size_t i = model.moleculeCount; i-- > 0;)
+	{
+		const Molecule& mol = model.molecules[i];
+		if (ownsMolecule(mol)) continue;
+
+		MoleculeParcel parcel = {mol, model.forces? model.forces[i] : Vector(0, 0, 0)};
+		if (mol.coords.x < slabFirst) toLeft .push_back(parcel);
+		else                          toRight.push_back(parcel);
+
+		model.removeMolecule(i);
+	}
+
+	exchangeWithNeighbors(toLeft, toRight, received);
+
+	for (const MoleculeParcel& parcel : received)
+	{
+		model.addMolecule(parcel.mol);
+		if (model.forces) model.forces[model.moleculeCount - 1] = parcel.force;
+	}
+}
+
+//==============================================
+// SIMULATION CYCLE
+//==============================================
+
+void SlabDomain::iterationCycle()
+{
+	if (model.longRangeForce != NO_LONG_RANGE_FORCE)
+	{
+		printf("SlabDomain::iterationCycle(): Long-range forces are not supported across slabs\n");
+		exit(1);
+	}
+
+	// The first and the last slab do not exchange anything:
+	if (transport->rankCount() > 1 && model.box.getBoundary(0) == PERIODIC_BOUNDARY)
+	{
+		printf("SlabDomain::iterationCycle(): Slabs do not wrap around, x has to have walls\n");
+		exit(1);
+	}
+
+	// Ghosts and migrants only ever go to the nearest slabs:
+	if (transport->rankCount() > 1 && slabLast - slabFirst < haloWidth + model.neighborList->skin)
+	{
+		printf("SlabDomain::iterationCycle(): Slabs are thinner than the halo, use fewer ranks or a thinner skin!\n");
+		exit(1);
+	}
+
+	if (needsExchange())
+	{
+		model.removeGhostMolecules();
+		migrateMolecules();
+		exchangeGhosts();
+	}
+	else refreshGhosts();
+
+	model.iterationCycle();
+}
+
+// Same fix-up as GasModel::fixEnergy(), with energies summed over the whole box.
+// Every molecule was swept by the rank that owned it at the time, so the sums of the last sweep
+// still cover the box once after migration.
+void SlabDomain::fixEnergy()
+{
+	PhysVal_t energies[2];
+	if (model.iteration == 0) model.measureEnergy(energies[0], energies[1]);
+	else
+	{
+		energies[0] = model.sweptKineticEnergy;
+		energies[1] = model.sweptGravityEnergy + model.currPotentialEnergy;
+	}
+
+	sumOverRanks(energies, 2);
+
+	if (model.prevTotalEnergyCalculated)
+		model.scaleSpeeds(std::sqrt((model.prevTotalEnergy - energies[1])/energies[0]));
+
+	model.prevTotalEnergy = energies[0] + energies[1];
+	model.currPotentialEnergy = 0.0;
+
+	model.prevTotalEnergyCalculated = true;
+}
+
+size_t SlabDomain::globalMoleculeCount()
+{
+	PhysVal_t count = model.moleculeCount - model.ghostCount;
+	sumOverRanks(&count, 1);
+
+	return static_cast<size_t>(count);
+}
+
+std::vector<Molecule> SlabDomain::gatherMolecules()
+{
+	std::vector<Molecule> gathered;
+	size_t ownCount = model.moleculeCount - model.ghostCount;
+
+	if (transport->rank() != 0)
+	{
+		uint64_t count = ownCount;
+		transport->send(0, &count, sizeof(count));
+		transport->send(0, model.molecules, count * sizeof(Molecule));
+		return gathered;
+	}
+
+	gathered.assign(model.molecules, model.molecules + ownCount);
+	for (size_t rank = 1; rank < transport->rankCount(); ++rank)
+	{
+		uint64_t count = 0;
+		transport->receive(rank, &count, sizeof(count));
+
+		size_t first = gathered.size();
+		gathered.resize(first + count);
+		transport->receive(rank, gathered.data() + first, count * sizeof(Molecule));
+	}
+
+	return gathered;
+}
@@ -0,0 +1,79 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef GAS_MODEL_DOMAIN_HPP_INCLUDED
+#define GAS_MODEL_DOMAIN_HPP_INCLUDED
+
+#include <vector>
+
+#include "Model.hpp"
+#include "Transport.hpp"
+
+// Molecule on its way to another rank, with the force of its next integration step
+struct MoleculeParcel
+{
+	Molecule mol;
+	Vector force;
+};
+
+// One slab of the box along x, every rank of the transport runs one.
+// Each model spans the whole box, so coordinates and walls stay global, but it owns only
+// the molecules of its slab. Molecules within the halo of a neighbor slab visit it as ghosts,
+// molecules that leave the slab migrate to the neighbor.
+// Ghosts stay in the model between steps and are refreshed in place every step. Ghosts are picked
+// anew and molecules migrate only once some molecule has moved by half the Verlet skin, so neighbor
+// lists and a refitted tree live on in between. Till then molecules may stray from their slab by
+// half the skin, the halo is wider by the skin to cover it.
+// Long-range forces see the whole box and are not supported.
+class SlabDomain
+{
+public:
+	// The transport has to be set up before, forking ranks next to a thread pool does not work
+	SlabDomain(Transport* newTransport, Vector boxSize, size_t threads = 1, GasType gas = POTENTIAL_GAS,
+	           size_t capacity = DEFAULT_MOLECULE_CAPACITY);
+
+	// Molecules outside the slab are dropped, so every rank can be given all of them.
+	// Ghosts are picked anew on the next step:
+	void addMolecule(Molecule mol);
+
+	void iterationCycle();
+	void fixEnergy();
+
+	size_t globalMoleculeCount();
+
+	// Molecules of all ranks in rank order, empty on ranks other than 0
+	std::vector<Molecule> gatherMolecules();
+
+	GasModel model;
+
+	Transport* transport;
+	PhysVal_t slabFirst;
+	PhysVal_t slabLast;
+	PhysVal_t haloWidth;
+
+private:
+	bool ownsMolecule(const Molecule& mol) const;
+
+	void sendParcels(size_t toRank, const std::vector<MoleculeParcel>& parcels);
+	void receiveParcels(size_t fromRank, std::vector<MoleculeParcel>& parcels);
+	void exchangeWithNeighbors(const std::vector<MoleculeParcel>& toLeft,
+	                           const std::vector<MoleculeParcel>& toRight,
+	                           std::vector<MoleculeParcel>& received);
+	void sumOverRanks(PhysVal_t* values, size_t count);
+
+	bool needsExchange();
+	void packGhosts();
+	void exchangeGhosts();
+	void refreshGhosts();
+	void migrateMolecules();
+
+	std::vector<MoleculeParcel> toLeft;
+	std::vector<MoleculeParcel> toRight;
+	std::vector<MoleculeParcel> received;
+
+	// Own molecules sent to the neighbors as ghosts and where the own molecules were, as of the last exchange:
+	bool exchanged;
+	std::vector<size_t> ghostsLeft;
+	std::vector<size_t> ghostsRight;
+	std::vector<Vector> exchangeCoords;
+};
+
+#endif  // GAS_MODEL_DOMAIN_HPP_INCLUDED
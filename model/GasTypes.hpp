@@ -0,0 +1,52 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef GAS_MODEL_GAS_TYPES_HPP_INCLUDED
+#define GAS_MODEL_GAS_TYPES_HPP_INCLUDED
+
+//==============================================
+// GAS TYPES
+//==============================================
+// IDEAL     - molecules fly through each other
+// BOUNCY    - hard spheres
+// POTENTIAL - hard spheres with Lennard-Jones
+//             attraction and gravity
+//==============================================
+
+enum GasType
+{
+	IDEAL_GAS     = 0,
+	BOUNCY_GAS    = 1,
+	POTENTIAL_GAS = 2
+};
+
+// Compile-time policies the hot loops are instantiated on, one instantiation per gas type.
+// Gases that do not attract never touch forces and never run the attraction pass.
+struct IdealGas
+{
+	static constexpr GasType TYPE     = IDEAL_GAS;
+	static constexpr bool    COLLIDES = false;
+	static constexpr bool    ATTRACTS = false;
+};
+
+struct BouncyGas
+{
+	static constexpr GasType TYPE     = BOUNCY_GAS;
+	static constexpr bool    COLLIDES = true;
+	static constexpr bool    ATTRACTS = false;
+};
+
+struct PotentialGas
+{
+	static constexpr GasType TYPE     = POTENTIAL_GAS;
+	static constexpr bool    COLLIDES = true;
+	static constexpr bool    ATTRACTS = true;
+};
+
+// Outer Lennard-Jones shell of multiple time stepping, collisions are left to the inner steps
+struct OuterShellGas
+{
+	static constexpr GasType TYPE     = POTENTIAL_GAS;
+	static constexpr bool    COLLIDES = false;
+	static constexpr bool    ATTRACTS = true;
+};
+
+#endif // GAS_MODEL_GAS_TYPES_HPP_INCLUDED
@@ -0,0 +1,185 @@
+// No Copyright. Vladislav Aleinik 2019
+#include "LennardJonesTable.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+//==============================================
+// ANALYTIC FORM IN s = r^2
+//==============================================
+
+// F/r = A*s^-7 + B*s^-4
+inline PhysVal_t forceOverDistAt(size_t pairIndex, PhysVal_t lenSqr)
+{
+	PhysVal_t power2 = 1 / lenSqr;
+	PhysVal_t power6 = power2*power2*power2;
+
+	return (LENNARD_JONES_FORCE_A[pairIndex] * power6 + LENNARD_JONES_FORCE_B[pairIndex]) * power6 * power2;
+}
+
+inline PhysVal_t forceOverDistDerivative(size_t pairIndex, PhysVal_t lenSqr)
+{
+	PhysVal_t power2 = 1 / lenSqr;
+	PhysVal_t power6 = power2*power2*power2;
+
+	return (-7 * LENNARD_JONES_FORCE_A[pairIndex] * power6 - 4 * LENNARD_JONES_FORCE_B[pairIndex]) * power6 * power2 * power2;
+}
+
+// U = A*s^-6 + B*s^-3
+inline PhysVal_t potentialAt(size_t pairIndex, PhysVal_t lenSqr)
+{
+	PhysVal_t power2 = 1 / lenSqr;
+	PhysVal_t power6 = power2*power2*power2;
+
+	return (LENNARD_JONES_POTENTIAL_A[pairIndex] * power6 + LENNARD_JONES_POTENTIAL_B[pairIndex]) * power6;
+}
+
+inline PhysVal_t potentialDerivative(size_t pairIndex, PhysVal_t lenSqr)
+{
+	PhysVal_t power2 = 1 / lenSqr;
+	PhysVal_t power6 = power2*power2*power2;
+
+	return (-6 * LENNARD_JONES_POTENTIAL_A[pairIndex] * power6 - 3 * LENNARD_JONES_POTENTIAL_B[pairIndex]) * power6 * power2;
+}
+
+// Hermite cubic on u in [0; 1] from values and u-derivatives at both ends
+void hermiteCoeffs(PhysVal_t* coeffs, PhysVal_t value0, PhysVal_t value1, PhysVal_t slope0, PhysVal_t slope1)
+{
+	coeffs[0] = value0;
+	coeffs[1] = slope0;
+	coeffs[2] = 3 * (value1 - value0) - 2 * slope0 - slope1;
+	coeffs[3] = 2 * (value0 - value1) +     slope0 + slope1;
+}
+
+//==============================================
+// LennardJonesTable IMPLEMENTATION
+//==============================================
+
+LennardJonesTable::LennardJonesTable(size_t newIntervals) :
+	intervals        (newIntervals? newIntervals : 1),
+	lenSqrStart      {},
+	invStep          {},
+	coeffs           (nullptr),
+	floatCoeffs      (nullptr),
+	floatLenSqrStart {},
+	floatInvStep     {}
+{
+	size_t count = TYPES_COUNT_SQR * intervals * LENNARD_JONES_TABLE_COEFFS;
+
+	coeffs      = static_cast<PhysVal_t*>(std::aligned_alloc(64, count * sizeof(PhysVal_t)));
+	floatCoeffs = static_cast<float*>    (std::aligned_alloc(64, (count * sizeof(float) + 63) / 64 * 64));
+	if (!coeffs || !floatCoeffs)
+	{
+		printf("LennardJonesTable::ctor(): Unable to allocate memory!\n");
+		exit(1);
+	}
+
+	for (size_t pairIndex = 0; pairIndex < TYPES_COUNT_SQR; ++pairIndex)
+	{
+		PhysVal_t start = LENNARD_JONES_CLOSEST_SQR[pairIndex];
+		PhysVal_t step  = (POTENTIAL_CUTOFF_MAX_RADIUS_SQUARE - start) / intervals;
+
+		lenSqrStart[pairIndex] = start;
+		invStep    [pairIndex] = 1 / step;
+
+		floatLenSqrStart[pairIndex] = lenSqrStart[pairIndex];
+		floatInvStep    [pairIndex] = invStep    [pairIndex];
+
+		for (size_t interval = 0; interval < intervals; ++interval)
+		{
+			PhysVal_t lenSqr0 = start + step *  interval;
+			PhysVal_t lenSqr1 = start + step * (interval + 1);
+
+			PhysVal_t* block = coeffs + (pairIndex * intervals + interval) * LENNARD_JONES_TABLE_COEFFS;
+
+			hermiteCoeffs(block,
+			              forceOverDistAt(pairIndex, lenSqr0), forceOverDistAt(pairIndex, lenSqr1),
+			              step * forceOverDistDerivative(pairIndex, lenSqr0),
+			              step * forceOverDistDerivative(pairIndex, lenSqr1));
+
+			hermiteCoeffs(block + 4,
+			              potentialAt(pairIndex, lenSqr0), potentialAt(pairIndex, lenSqr1),
+			              step * potentialDerivative(pairIndex, lenSqr0),
+			              step * potentialDerivative(pairIndex, lenSqr1));
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i)
+		floatCoeffs[i] = coeffs[i];
+}
+
+LennardJonesTable::~LennardJonesTable()
+{
+	std::free(coeffs);
+	std::free(floatCoeffs);
+}
+
+inline void LennardJonesTable::evaluate(size_t pairIndex, PhysVal_t lenSqr, PhysVal_t& forceOverDist, PhysVal_t& potential) const
+{
+	PhysVal_t position = (lenSqr - lenSqrStart[pairIndex]) * invStep[pairIndex];
+
+	if (position < 0.0)
+	{
+		forceOverDist = 0.0;
+		potential     = coeffs[pairIndex * intervals * LENNARD_JONES_TABLE_COEFFS + 4];
+		return;
+	}
+
+	size_t interval = position;
+	if (interval >= intervals) interval = intervals - 1;
+
+	PhysVal_t u = position - interval;
+	const PhysVal_t* block = coeffs + (pairIndex * intervals + interval) * LENNARD_JONES_TABLE_COEFFS;
+
+	forceOverDist = ((block[3] * u + block[2]) * u + block[1]) * u + block[0];
+	potential     = ((block[7] * u + block[6]) * u + block[5]) * u + block[4];
+}
+
+PhysVal_t LennardJonesTable::reportError(size_t samplesPerInterval) const
+{
+	const char* TYPE_NAMES[TYPES_COUNT] = {"He", "Ar"};
+
+	printf("Lennard-Jones table: %zu intervals per pair, %zu KiB\n", intervals,
+	       TYPES_COUNT_SQR * intervals * LENNARD_JONES_TABLE_COEFFS * sizeof(PhysVal_t) / 1024);
+
+	PhysVal_t worstError = 0.0;
+	for (size_t pairIndex = 0; pairIndex < TYPES_COUNT_SQR; ++pairIndex)
+	{
+		MoleculeType typeA = static_cast<MoleculeType>(pairIndex / TYPES_COUNT);
+		MoleculeType typeB = static_cast<MoleculeType>(pairIndex % TYPES_COUNT);
+
+		PhysVal_t forceError     = 0.0, forceScale     = 0.0;
+		PhysVal_t potentialError = 0.0, potentialScale = 0.0;
+
+		// Sample midpoints, so that rounding at the cutoffs does not count as an error:
+		size_t samples = intervals * samplesPerInterval;
+		for (size_t sample = 0; sample < samples; ++sample)
+		{
+			PhysVal_t lenSqr = lenSqrStart[pairIndex] + (POTENTIAL_CUTOFF_MAX_RADIUS_SQUARE - lenSqrStart[pairIndex]) * (sample + 0.5) / samples;
+			PhysVal_t distance = std::sqrt(lenSqr);
+
+			PhysVal_t forceOverDist, potential;
+			evaluate(pairIndex, lenSqr, forceOverDist, potential);
+
+			PhysVal_t exactForceOverDist = LennardJonesForce    (typeA, typeB, distance) / distance;
+			PhysVal_t exactPotential     = LennardJonesPotential(typeA, typeB, distance);
+
+			forceError     = std::fmax(forceError,     std::fabs(forceOverDist - exactForceOverDist));
+			potentialError = std::fmax(potentialError, std::fabs(potential     - exactPotential));
+
+			forceScale     = std::fmax(forceScale,     std::fabs(exactForceOverDist));
+			potentialScale = std::fmax(potentialScale, std::fabs(exactPotential));
+		}
+
+		forceError     /= forceScale;
+		potentialError /= potentialScale;
+
+		printf("    %s-%s: force error %.3e, potential error %.3e\n",
+		       TYPE_NAMES[typeA], TYPE_NAMES[typeB], forceError, potentialError);
+
+		worstError = std::fmax(worstError, std::fmax(forceError, potentialError));
+	}
+
+	return worstError;
+}
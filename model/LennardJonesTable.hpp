@@ -0,0 +1,54 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef GAS_MODEL_LENNARD_JONES_TABLE_HPP_INCLUDED
+#define GAS_MODEL_LENNARD_JONES_TABLE_HPP_INCLUDED
+
+#include "MoleculeTypes.hpp"
+
+#include <cstddef>
+
+//==============================================
+// TABULATED LENNARD-JONES
+//==============================================
+// Both F(r)/r and U(r) are cubic Hermite splines
+// in s = r^2 on a uniform grid from the closest
+// allowed distance up to the cutoff, one per pair.
+// A lookup costs a multiply, a truncation and two
+// Horner polynomials - no root and no division.
+//==============================================
+
+const size_t DEFAULT_LENNARD_JONES_TABLE_INTERVALS = 1024;
+
+// Coefficients of one interval: F/r first, then U, lowest power first
+const size_t LENNARD_JONES_TABLE_COEFFS = 8;
+
+struct LennardJonesTable
+{
+	LennardJonesTable(size_t newIntervals);
+	~LennardJonesTable();
+
+	LennardJonesTable(const LennardJonesTable&) = delete;
+	LennardJonesTable& operator=(const LennardJonesTable&) = delete;
+
+	// Same cutoffs as LennardJonesForce and LennardJonesPotential: no force closer than the
+	// closest distance, potential frozen there. Only valid up to POTENTIAL_CUTOFF_MAX_RADIUS.
+	inline void evaluate(size_t pairIndex, PhysVal_t lenSqr, PhysVal_t& forceOverDist, PhysVal_t& potential) const;
+
+	// Samples every interval against the analytic form, prints the worst errors per pair
+	// relative to the largest tabulated value and returns the worst of them all
+	PhysVal_t reportError(size_t samplesPerInterval = 16) const;
+
+	size_t intervals;
+	PhysVal_t lenSqrStart[TYPES_COUNT_SQR];
+	PhysVal_t invStep    [TYPES_COUNT_SQR];
+
+	// [pair][interval][coefficient], one 64-byte cache line per interval
+	PhysVal_t* coeffs;
+
+	// Same in float for the mixed-precision kernel, one 32-byte block per interval,
+	// grid constants padded to a register of eight floats
+	float* floatCoeffs;
+	alignas(32) float floatLenSqrStart[8];
+	alignas(32) float floatInvStep    [8];
+};
+
+#endif // GAS_MODEL_LENNARD_JONES_TABLE_HPP_INCLUDED
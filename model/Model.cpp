@@ -1,44 +1,166 @@
 // No Copyright. Vladislav Aleinik 2019
 #include "Model.hpp"
+#include "Checkpoint.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 //==============================================
 // OctTreeNode IMPLEMENTATION
 //==============================================
 
-void OctTreeNode::initNode(int moleculeI, int prevI, unsigned newCount, Vector newCenter) 
+void OctTreeNode::initNode(int moleculeI, unsigned newCount, Vector newCenter, unsigned newDepth, unsigned newOctant)
 {
-	for (size_t i = 0; i < 8; ++i) octs[i] = -1; 
+	firstChild = -1;
+	molecule   = moleculeI;
+	count      = newCount;
+	childMask  = 0;
+	octant     = newOctant;
+	depth      = newDepth;
 
-	prev = prevI; 
-	molecule = moleculeI; 
-	count = newCount;
-	center = newCenter;
+	center[0] = newCenter.x;
+	center[1] = newCenter.y;
+	center[2] = newCenter.z;
+	center[3] = 0.0f;
+}
+
+inline Vector OctTreeNode::getCenter() const
+{
+	Vector wide;
+	wide.reg256 = _mm256_cvtps_pd(_mm_load_ps(center));
+
+	return wide;
+}
+
+inline unsigned OctTreeNode::childCount() const
+{
+	return __builtin_popcount(childMask);
+}
+
+// Position of the child in octant oct among the node's children
+inline unsigned OctTreeNode::childRank(unsigned oct) const
+{
+	return __builtin_popcount(childMask & ((1u << oct) - 1));
 }
 
 //==============================================
 // GasModel CONSTRUCTION/DESTRUCTION
 //==============================================
 
-const size_t OCT_TREE_MAX_NODES = 4 * MAX_NUMBER_OF_MOLECULES;
-const size_t OCT_TREE_MAX_SEPARTION_TRIES = ceil(log2(OCT_TREE_MAX_NODES));
-const size_t OCT_TREE_MAX_DEPTH = 10 * ceil(log2(OCT_TREE_MAX_NODES));
+PhysVal_t gasInteractionRange(GasType gas)
+{
+	return (gas == POTENTIAL_GAS)? POTENTIAL_INTERACTION_RANGE : COLLISION_INTERACTION_RANGE;
+}
+
+// Molecules cover a fraction of an angstrom per step, so lists live for dozens of steps
+const PhysVal_t DEFAULT_VERLET_SKIN = 2 * MAXIMUM_COLLISION_RADIUS;
+
+// Keys hold MORTON_DEPTH octal digits, one per tree level, x-bit first like in calculateOct
+const unsigned MORTON_DEPTH       = 21;
+const size_t   MORTON_CHUNK       = 4096;
+const unsigned RADIX_BITS         = 8;
+const size_t   RADIX_BUCKETS      = 1 << RADIX_BITS;
+const size_t   MAX_MORTON_CHUNKS  = 256;
+
+// Leaves never go deeper than the last Morton digit
+const size_t OCT_TREE_MAX_DEPTH = MORTON_DEPTH + 1;
+
+// Tree node centers are floats, relative rounding of which stays well below this
+const PhysVal_t TREE_CENTER_SLACK = 1.0 / (1 << 20);
 
-GasModel::GasModel(Vector newBoxSize) :
+// Uniformly spread molecules need a bit more than one node each
+const size_t OCT_TREE_NODES_PER_MOLECULE = 2;
+
+// Taking a molecule out and putting it back allocate at most a block of siblings and a chain of splits
+const size_t OCT_TREE_NODES_PER_MOVE = 2 * OCT_TREE_MAX_DEPTH;
+
+// Refits give way to a rebuild when more than one molecule in this many has to move,
+// or when abandoned child blocks make up more than one node in this many live ones
+const size_t OCT_TREE_REFIT_MOVES_LIMIT   = 8;
+const size_t OCT_TREE_REFIT_GARBAGE_LIMIT = 2;
+
+GasModel::GasModel(Vector newBoxSize, size_t threads, GasType gas, size_t capacity) :
 	box             (GasContainer(newBoxSize)),
-	molecules       (new Molecule[MAX_NUMBER_OF_MOLECULES]),
+	gasType         (gas),
+	interactionRange(gasInteractionRange(gas)),
+	molecules       (nullptr),
 	moleculeCount   (0),
-	octTree         (new OctTreeNode[OCT_TREE_MAX_NODES]),
+	moleculeCapacity(0),
+	ghostCount      (0),
+	forces          (nullptr),
+	neighborSearch  (OCT_TREE_SEARCH),
+	cellList        (new CellList(newBoxSize, interactionRange)),
+	neighborList    (new NeighborList(newBoxSize, interactionRange, DEFAULT_VERLET_SKIN)),
+	moleculeLayout  (ARRAY_OF_STRUCTS),
+	precision       (DOUBLE_PRECISION),
+	moleculeArrays  (new MoleculeArrays()),
+	collisionEvents (nullptr),
+	lennardJonesTable (nullptr),
+	octTree         (nullptr),
+	octTreeParents  (nullptr),
 	octTreeSize     (0),
-	octTreeFuckedUp (false),
+	octTreeCapacity (0),
 	sizeAtDepth     (new Vector[OCT_TREE_MAX_DEPTH]),
+	octTreeNext     (nullptr),
+	octTreeDegenerateLeaves  (0),
+	octTreeDegenerateUpdates (0),
+	mortonKeys         (nullptr),
+	mortonOrder        (nullptr),
+	mortonKeysScratch  (nullptr),
+	mortonOrderScratch (nullptr),
+	radixHistograms    (new size_t[MAX_MORTON_CHUNKS * RADIX_BUCKETS]),
+	octTreeBuild        (nullptr),
+	octTreeBuildParents (nullptr),
+	octTreeChildStarts  (nullptr),
+	octTreeUpdate        (REFIT_OCT_TREE),
+	octTreeRefittable    (false),
+	octTreeMoleculeCount (0),
+	octTreeGarbage       (0),
+	octTreeLeaves        (nullptr),
+	octTreeKeys          (nullptr),
+	longRangeForce    (NO_LONG_RANGE_FORCE),
+	longRangeCoupling (0.0),
+	openingAngle      (DEFAULT_OPENING_ANGLE),
+	multipoleOrder    (QUADRUPOLE_ORDER),
+	octTreeMultipoles (nullptr),
+	iteration         (0),
+	outerShellSteps   (1),
+	outerShellStart   (0),
+	innerShellRadius  (POTENTIAL_CUTOFF_MAX_RADIUS),
+	attractionShell   (FULL_ATTRACTION_SHELL),
+	outerPotentialEnergy (0.0),
+	threadPool      (nullptr),
+	brickCounts     {1, 1, 1},
+	brickCount      (0),
+	brickSize       (newBoxSize),
+	brickColorStarts{},
+	bricksByColor   (nullptr),
+	brickStarts     (nullptr),
+	brickMolecules  (nullptr),
+	brickPotentialEnergy      (nullptr),
 	prevTotalEnergy           (0.0),  // Hot-Fix
 	currPotentialEnergy       (0.0),  // Hot-Fix
-	prevTotalEnergyCalculated (false) // Hot-Fix
+	prevTotalEnergyCalculated (false), // Hot-Fix
+	sweptKineticEnergy        (0.0),
+	sweptGravityEnergy        (0.0),
+	sweptEnergyValid          (false),
+	pendingSpeedScale         (1.0),
+	observers          (),
+	observerSums       (),
+	observerSumCount   (0),
+	observerChunkCount (0)
 {
-	if (!molecules || !octTree || !sizeAtDepth)
+	if (!cellList || !neighborList || !moleculeArrays || !sizeAtDepth || !radixHistograms)
 	{
 		printf("GasModel::ctor(): Unable to allocate memory!\n");
 		exit(1);
@@ -48,238 +170,2117 @@ GasModel::GasModel(Vector newBoxSize) :
 	{
 		sizeAtDepth[i] = box.containerSize * std::pow(0.5, i + 1);
 	}
+
+	reserveMolecules(capacity);
+	layoutBricks();
+	setThreadCount(threads);
 }
 
 GasModel::~GasModel()
 {
 	delete[] molecules;
+	delete[] forces;
+	delete cellList;
+	delete neighborList;
+	delete moleculeArrays;
+	delete collisionEvents;
+	delete lennardJonesTable;
 	delete[] octTree;
+	delete[] octTreeParents;
+	delete[] octTreeNext;
+	delete[] octTreeBuild;
+	delete[] octTreeBuildParents;
+	delete[] octTreeChildStarts;
+	delete[] octTreeLeaves;
+	delete[] octTreeKeys;
+	delete[] octTreeMultipoles;
 	delete[] sizeAtDepth;
+	delete[] mortonKeys;
+	delete[] mortonOrder;
+	delete[] mortonKeysScratch;
+	delete[] mortonOrderScratch;
+	delete[] radixHistograms;
+
+	delete threadPool;
+	delete[] bricksByColor;
+	delete[] brickStarts;
+	delete[] brickMolecules;
+	delete[] brickPotentialEnergy;
 }
 
 //==============================================
-// BARNES-HUT TREE CONSTRUCTION
+// MULTITHREADING
 //==============================================
 
-void GasModel::addMolecule(Molecule mol)
-{
-	if (moleculeCount == MAX_NUMBER_OF_MOLECULES) return;
+const size_t    MAX_BRICKS        = 4096;
+const size_t    BRICK_COLORS      = 8;
 
-	molecules[moleculeCount] = mol;
+void GasModel::setThreadCount(size_t threads)
+{
+	if (threads == 0) threads = 1;
 
-	++moleculeCount;
+	delete threadPool;
+	threadPool = new ThreadPool(threads);
 }
 
-char GasModel::calculateOct(size_t moleculeI, int curI) const
+size_t GasModel::getThreadCount() const
 {
-	return ((molecules[moleculeI].coords.x > octTree[curI].center.x) ? 4 : 0) +
-	       ((molecules[moleculeI].coords.y > octTree[curI].center.y) ? 2 : 0) + 
-	       ((molecules[moleculeI].coords.z > octTree[curI].center.z) ? 1 : 0);
+	return threadPool->size();
 }
 
-void GasModel::insertNode(int moleculeI, int prevI, unsigned newCount, unsigned depth, char oct)
+void GasModel::layoutBricks()
 {
-	if (octTreeSize >= OCT_TREE_MAX_NODES || depth >= OCT_TREE_MAX_DEPTH)
+	// Two bricks of the same colour are separated by a whole brick, which is wider than
+	// two interaction ranges plus a margin for the shifts out of collisions during the pass.
+	// So bricks of one colour never touch a common molecule and can be processed concurrently.
+	const PhysVal_t brickMinSize = 2 * interactionRange + 4 * MAXIMUM_COLLISION_RADIUS;
+
+	PhysVal_t boxSizes[3] = {box.containerSize.x, box.containerSize.y, box.containerSize.z};
+
+	for (size_t axis = 0; axis < 3; ++axis)
 	{
-		octTreeFuckedUp = true;
-		return;
+		brickCounts[axis] = (boxSizes[axis] < 2 * brickMinSize)? 1 : std::floor(boxSizes[axis] / brickMinSize);
+	}
+
+	// The layout does not depend on the thread count, so any number of threads gives the same result.
+	// More bricks than that only cost bookkeeping:
+	while (brickCounts[0] * brickCounts[1] * brickCounts[2] > MAX_BRICKS)
+	{
+		size_t widest = 0;
+		for (size_t axis = 1; axis < 3; ++axis)
+		{
+			if (brickCounts[axis] > brickCounts[widest]) widest = axis;
+		}
+
+		brickCounts[widest] /= 2;
+	}
+
+	// Across a periodic axis the last brick touches the first one, so only an even count keeps the colours apart:
+	for (size_t axis = 0; axis < 3; ++axis)
+	{
+		if (box.getBoundary(axis) == PERIODIC_BOUNDARY && brickCounts[axis] % 2 == 1 && brickCounts[axis] > 1)
+			--brickCounts[axis];
 	}
 
-	octTree[prevI].octs[0 + oct] = octTreeSize;
+	brickCount = brickCounts[0] * brickCounts[1] * brickCounts[2];
+	brickSize  = Vector(boxSizes[0] / brickCounts[0], boxSizes[1] / brickCounts[1], boxSizes[2] / brickCounts[2]);
 
-	Vector curCenter = {sizeAtDepth[depth].x * ((oct & 0b00000100)? 1.0 : -1.0),
-	                    sizeAtDepth[depth].y * ((oct & 0b00000010)? 1.0 : -1.0),
-	                    sizeAtDepth[depth].z * ((oct & 0b00000001)? 1.0 : -1.0)};
+	delete[] bricksByColor;
+	delete[] brickStarts;
+	delete[] brickPotentialEnergy;
 
-	curCenter += octTree[prevI].center;
+	bricksByColor        = new size_t[brickCount];
+	brickStarts          = new size_t[brickCount + 1];
+	brickPotentialEnergy = new PhysVal_t[brickCount];
 
-	octTree[octTreeSize].initNode(moleculeI, prevI, newCount, curCenter);
+	// Bricks with equal coordinate parities share a colour:
+	size_t colorI = 0;
+	for (size_t color = 0; color < BRICK_COLORS; ++color)
+	{
+		brickColorStarts[color] = colorI;
 
-	++octTreeSize;
+		for (size_t x = (color >> 2) & 1; x < brickCounts[0]; x += 2)
+		for (size_t y = (color >> 1) & 1; y < brickCounts[1]; y += 2)
+		for (size_t z = (color >> 0) & 1; z < brickCounts[2]; z += 2)
+		{
+			bricksByColor[colorI++] = (x * brickCounts[1] + y) * brickCounts[2] + z;
+		}
+	}
+	brickColorStarts[BRICK_COLORS] = colorI;
 }
 
-void GasModel::buildOctTree()
+size_t brickCoordinate(PhysVal_t coord, PhysVal_t brickSize, size_t brickCount)
 {
-	if (moleculeCount == 0) return;
+	if (coord <= 0.0) return 0;
 
-	octTree[0].initNode(0, -1, 1, sizeAtDepth[0]);
-	octTreeSize = 1;
-	octTreeFuckedUp = false;
+	size_t brick = coord / brickSize;
+	return (brick < brickCount)? brick : brickCount - 1;
+}
 
-	for (size_t moleculeI = 1; moleculeI < moleculeCount; ++moleculeI)
+void GasModel::sortIntoBricks()
+{
+	auto brickOf = [this](size_t moleculeI)
 	{
-		// Search for place to insert node into an octo-tree
-		int prevI = 0;
-		char oct = 0;
-		unsigned depth = 0;
-		for (int curI = 0; curI != -1;)
-		{
-			++depth;
-			octTree[curI].count += 1;
+		const Vector& coords = molecules[moleculeI].coords;
 
-			oct = calculateOct(moleculeI, curI);
+		return (brickCoordinate(coords.x, brickSize.x, brickCounts[0])  * brickCounts[1] +
+		        brickCoordinate(coords.y, brickSize.y, brickCounts[1])) * brickCounts[2] +
+		        brickCoordinate(coords.z, brickSize.z, brickCounts[2]);
+	};
 
-			prevI = curI;
-			curI = octTree[curI].octs[0 + oct];
-		}
+	// Counting sort keeps molecules of a brick in index order:
+	for (size_t brickI = 0; brickI <= brickCount; ++brickI)
+		brickStarts[brickI] = 0;
 
-		// Insert node
-		if (octTree[prevI].count == 2) // Tree rebalancing needed
-		{
-			int oldMoleculeI = octTree[prevI].molecule;
-			octTree[prevI].molecule = -1;
+	for (size_t i = 0; i < moleculeCount; ++i)
+		brickStarts[brickOf(i) + 1] += 1;
 
-			char oldOct = calculateOct(oldMoleculeI, prevI);
+	for (size_t brickI = 0; brickI < brickCount; ++brickI)
+		brickStarts[brickI + 1] += brickStarts[brickI];
 
-			for (unsigned char seperationTries = 0; oct == oldOct && seperationTries < OCT_TREE_MAX_SEPARTION_TRIES; ++seperationTries)
-			{
-				prevI = octTreeSize;
+	for (size_t i = 0; i < moleculeCount; ++i)
+		brickMolecules[brickStarts[brickOf(i)]++] = i;
 
-				insertNode(-1, prevI, 2, depth, oct);
-				if (octTreeFuckedUp) return;
+	// Filling shifted every start one brick forward:
+	for (size_t brickI = brickCount; brickI > 0; --brickI)
+		brickStarts[brickI] = brickStarts[brickI - 1];
+	brickStarts[0] = 0;
+}
 
-				oct    = calculateOct(   moleculeI, prevI);
-				oldOct = calculateOct(oldMoleculeI, prevI);  
- 
-				++depth;
-			}
+//==============================================
+// BARNES-HUT TREE CONSTRUCTION
+//==============================================
 
-			if (oct != oldOct)
-			{
-				insertNode(   moleculeI, prevI, 1, depth, oct);
-				insertNode(oldMoleculeI, prevI, 1, depth, oldOct);
-			}
-			else
-			{
-				insertNode(   moleculeI, prevI, 1, depth, oct);
-				insertNode(oldMoleculeI, prevI, 1, depth, oct ^ 1);
-			}
-		}
-		else // Just a single insertion will do
-		{
-			insertNode(moleculeI, prevI, 1, depth, oct);
-		}
+// Copies the first keep elements over to a new array of the given size
+template<typename Elem>
+void growArray(Elem*& array, size_t keep, size_t size)
+{
+	Elem* grown = new Elem[size];
+	if (!grown)
+	{
+		printf("GasModel: Unable to allocate memory!\n");
+		exit(1);
 	}
+
+	std::copy(array, array + keep, grown);
+
+	delete[] array;
+	array = grown;
 }
 
-//==============================================
-// MOLECULE INTERACTION
-//==============================================
+void GasModel::reserveMolecules(size_t capacity)
+{
+	if (capacity <= moleculeCapacity) return;
+
+	growArray(molecules, moleculeCount, capacity);
+	if (gasType == POTENTIAL_GAS) growArray(forces, moleculeCount, capacity);
+
+	// Rebuilt from scratch every step:
+	growArray(mortonKeys,         0, capacity);
+	growArray(mortonOrder,        0, capacity);
+	growArray(mortonKeysScratch,  0, capacity);
+	growArray(mortonOrderScratch, 0, capacity);
+	growArray(brickMolecules,     0, capacity);
+
+	// New molecules make for a rebuild, which fills these anew:
+	growArray(octTreeNext,   0, capacity);
+	growArray(octTreeLeaves, 0, capacity);
+	growArray(octTreeKeys,   0, capacity);
+	octTreeRefittable = false;
 
-const Vector MAX_COLLISON_BOX_SIZE = Vector(MAXIMUM_COLLISION_RADIUS,
-                                            MAXIMUM_COLLISION_RADIUS,
-                                            MAXIMUM_COLLISION_RADIUS);
+	moleculeCapacity = capacity;
 
-void GasModel::collideOneMoleculeBarnesHut(int moleculeI, int curI, unsigned depth)
+	reserveOctTree(OCT_TREE_NODES_PER_MOLECULE * capacity, 0);
+}
+
+// A refit goes on with the current tree, a rebuild keeps nothing
+void GasModel::reserveOctTree(size_t nodes, size_t liveNodes)
+{
+	if (nodes <= octTreeCapacity) return;
+
+	liveNodes = std::min(liveNodes, octTreeCapacity);
+	growArray(octTree,             liveNodes, nodes);
+	growArray(octTreeParents,      liveNodes, nodes);
+	growArray(octTreeBuild,        0, nodes);
+	growArray(octTreeBuildParents, 0, nodes);
+	growArray(octTreeChildStarts,  0, nodes);
+	growArray(octTreeMultipoles,   0, nodes);
+
+	octTreeCapacity = nodes;
+}
+
+void GasModel::addMolecule(Molecule mol)
 {
-	if (!(octTree[curI].center - molecules[moleculeI].coords).isInBox(sizeAtDepth[depth] + MAX_COLLISON_BOX_SIZE)) return;
+	if (moleculeCount == moleculeCapacity) reserveMolecules(2 * moleculeCapacity + 1);
 
-	if (octTree[curI].count == 1)
+	molecules[moleculeCount] = mol;
+	if (forces) forces[moleculeCount] = {0, 0, 0};
+
+	++moleculeCount;
+
+	sweptEnergyValid = false;
+}
+
+// Moves the last molecule into the freed place, ghosts are last and have to be removed before
+void GasModel::removeMolecule(size_t moleculeI)
+{
+	if (ghostCount != 0)
 	{
-		moleculesCollide(molecules[moleculeI], molecules[octTree[curI].molecule]);
+		printf("GasModel::removeMolecule(): Expected ghost molecules to be removed first\n");
+		exit(1);
 	}
-	else
+
+	--moleculeCount;
+
+	molecules[moleculeI] = molecules[moleculeCount];
+	if (forces) forces[moleculeI] = forces[moleculeCount];
+
+	neighborList->invalidate();
+	invalidateOctTree();
+	invalidateEvents();
+
+	sweptEnergyValid = false;
+}
+
+void GasModel::setBoundaries(Boundary boundaryX, Boundary boundaryY, Boundary boundaryZ)
+{
+	Boundary  boundaries[3] = {boundaryX, boundaryY, boundaryZ};
+	PhysVal_t sizes[3]      = {box.containerSize.x, box.containerSize.y, box.containerSize.z};
+
+	for (size_t axis = 0; axis < 3; ++axis)
 	{
-		for (size_t oct = 0; oct < 8; ++oct)
+		// No partner may be within range at two of its images:
+		if (boundaries[axis] == PERIODIC_BOUNDARY && sizes[axis] < 2 * interactionRange)
 		{
-			if (octTree[curI].octs[oct] != -1)
-				collideOneMoleculeBarnesHut(moleculeI, octTree[curI].octs[oct], depth + 1);
+			printf("GasModel::setBoundaries(): Periodic axes have to span two interaction ranges\n");
+			exit(1);
 		}
+
+		box.setBoundary(axis, boundaries[axis]);
+	}
+
+	if (box.isPeriodic() && longRangeForce != NO_LONG_RANGE_FORCE)
+	{
+		printf("GasModel::setBoundaries(): Long-range forces do not see periodic images\n");
+		exit(1);
+	}
+
+	if (box.isPeriodic() && collisionEvents)
+	{
+		printf("GasModel::setBoundaries(): Predicted events only know walls\n");
+		exit(1);
 	}
+
+	cellList    ->setPeriod(box.period);
+	neighborList->setPeriod(box.period);
+
+	layoutBricks();
+}
+
+void GasModel::addGhostMolecule(Molecule mol, Vector force)
+{
+	addMolecule(mol);
+	if (forces) forces[moleculeCount - 1] = force;
+
+	++ghostCount;
+}
+
+// Ghosts of the bouncy gases are predicted like other molecules, so their events go
+void GasModel::refreshGhostMolecule(size_t ghostI, Molecule mol, Vector force)
+{
+	size_t moleculeI = moleculeCount - ghostCount + ghostI;
+
+	molecules[moleculeI] = mol;
+	if (forces) forces[moleculeI] = force;
+
+	invalidateEvents();
+}
+
+void GasModel::removeGhostMolecules()
+{
+	if (ghostCount == 0) return;
+
+	moleculeCount -= ghostCount;
+	ghostCount = 0;
+
+	neighborList->invalidate();
+	invalidateOctTree();
+	invalidateEvents();
+}
+
+void GasModel::setNeighborSearch(NeighborSearch search)
+{
+	neighborSearch = search;
+
+	neighborList->invalidate();
+}
+
+void GasModel::setVerletSkin(PhysVal_t skin)
+{
+	neighborList->setSkin(skin);
 }
 
-const Vector MAX_POTENTIAL_BOX_SIZE = Vector(POTENTIAL_CUTOFF_MAX_RADIUS,
-                                             POTENTIAL_CUTOFF_MAX_RADIUS,
-                                             POTENTIAL_CUTOFF_MAX_RADIUS);
+void GasModel::setOctTreeUpdate(OctTreeUpdate update)
+{
+	octTreeUpdate = update;
+
+	invalidateOctTree();
+}
 
-void GasModel::attractOneMoleculeBarnesHut(int moleculeI, int curI, unsigned depth)
+// The next step rebuilds the tree from scratch
+void GasModel::invalidateOctTree()
 {
-	if (!(octTree[curI].center - molecules[moleculeI].coords).isInBox(sizeAtDepth[depth] + MAX_POTENTIAL_BOX_SIZE)) return;
+	octTreeRefittable = false;
+}
 
-	if (octTree[curI].count == 1)
+void GasModel::setLongRangeForce(LongRangeForce force, PhysVal_t angle, MultipoleOrder order)
+{
+	// Only attracting gases carry forces between steps:
+	if (force != NO_LONG_RANGE_FORCE && gasType != POTENTIAL_GAS)
 	{
-		moleculesAttract(currPotentialEnergy, molecules[moleculeI], molecules[octTree[curI].molecule]);
+		printf("GasModel::setLongRangeForce(): Long-range forces need a POTENTIAL gas\n");
+		exit(1);
 	}
-	else
+
+	if (force != NO_LONG_RANGE_FORCE && box.isPeriodic())
 	{
-		for (size_t oct = 0; oct < 8; ++oct)
-		{
-			if (octTree[curI].octs[oct] != -1)
-				attractOneMoleculeBarnesHut(moleculeI, octTree[curI].octs[oct], depth + 1);
-		}
+		printf("GasModel::setLongRangeForce(): Long-range forces do not see periodic images\n");
+		exit(1);
 	}
+
+	longRangeForce = force;
+	openingAngle   = angle;
+	multipoleOrder = order;
+
+	longRangeCoupling = (force == SELF_GRAVITY)?  -GRAVITATIONAL_CONSTANT :
+	                    (force == COULOMB_FORCE)?  COULOMB_CONSTANT : 0.0;
 }
 
-void GasModel::interactWithEachOtherNaive()
+void GasModel::setBouncyIntegration(BouncyIntegration integration)
 {
-	for (size_t i = 0; i < moleculeCount; ++i)
+	if (integration == EVENT_DRIVEN && gasType != BOUNCY_GAS)
 	{
-		for (size_t j = i + 1; j < moleculeCount; ++j)
-		{
-			moleculesCollide(molecules[i], molecules[j]);
-			moleculesAttract(currPotentialEnergy, molecules[i], molecules[j]);
-		}
+		printf("GasModel::setBouncyIntegration(): Events can only be predicted for a BOUNCY gas\n");
+		exit(1);
+	}
+
+	if (integration == EVENT_DRIVEN && box.isPeriodic())
+	{
+		printf("GasModel::setBouncyIntegration(): Predicted events only know walls\n");
+		exit(1);
+	}
+
+	delete collisionEvents;
+	collisionEvents = nullptr;
+
+	if (integration == EVENT_DRIVEN)
+		collisionEvents = new CollisionEvents(box.containerSize);
+}
+
+void GasModel::invalidateEvents()
+{
+	if (collisionEvents) collisionEvents->invalidate();
+}
+
+void GasModel::setMultipleTimeSteps(size_t outerSteps, PhysVal_t innerRadius)
+{
+	if (outerSteps > 1 && gasType != POTENTIAL_GAS)
+	{
+		printf("GasModel::setMultipleTimeSteps(): Only attraction can be split, it needs a POTENTIAL gas\n");
+		exit(1);
+	}
+
+	// Collisions are only checked on the inner steps:
+	if (innerRadius < COLLISION_INTERACTION_RANGE || POTENTIAL_CUTOFF_MAX_RADIUS < innerRadius)
+	{
+		printf("GasModel::setMultipleTimeSteps(): Inner radius has to be between the collision range and the cutoff\n");
+		exit(1);
 	}
+
+	outerShellSteps  = std::max<size_t>(outerSteps, 1);
+	innerShellRadius = innerRadius;
+
+	neighborList->setInnerRange((outerShellSteps == 1)? interactionRange : innerRadius);
+
+	// A single step takes the whole cutoff every time:
+	attractionShell = (outerShellSteps == 1)? FULL_ATTRACTION_SHELL : AttractionShell{-1.0, innerRadius * innerRadius, 1.0};
+
+	// The next step evaluates the outer shell:
+	outerShellStart      = iteration;
+	outerPotentialEnergy = 0.0;
 }
 
-void GasModel::interactWithEachOther()
+void GasModel::setMoleculeLayout(MoleculeLayout layout)
 {
-	buildOctTree();
+	moleculeLayout = layout;
+}
 
-	// Energy fix-up hot-fix:
-	currPotentialEnergy = 0.0;
+void GasModel::setPrecision(Precision newPrecision)
+{
+	precision = newPrecision;
+	moleculeArrays->setFloatCoords(precision == MIXED_PRECISION);
+}
 
-	if (octTreeFuckedUp) interactWithEachOtherNaive();
-	else
+PhysVal_t GasModel::reportPrecisionDrift(size_t steps)
+{
+	PhysVal_t drifts[2] = {0.0, 0.0};
+
+	for (Precision copyPrecision : {DOUBLE_PRECISION, MIXED_PRECISION})
 	{
-		for (size_t i = 0; i < moleculeCount; ++i)
+		GasModel copy(box.containerSize, threadPool->size(), gasType, moleculeCount);
+
+		copy.setBoundaries(box.getBoundary(0), box.getBoundary(1), box.getBoundary(2));
+		copy.setNeighborSearch(neighborSearch);
+		copy.setVerletSkin(neighborList->skin);
+		copy.setMoleculeLayout(STRUCT_OF_ARRAYS);
+		copy.setPrecision(copyPrecision);
+		copy.setLongRangeForce(longRangeForce, openingAngle, multipoleOrder);
+		copy.setMultipleTimeSteps(outerShellSteps, innerShellRadius);
+		if (lennardJonesTable) copy.setPotentialEvaluation(TABULATED_POTENTIAL, lennardJonesTable->intervals);
+
+		for (size_t i = 0; i < moleculeCount - ghostCount; ++i)
+		{
+			copy.addMolecule(molecules[i]);
+			if (forces) copy.forces[i] = forces[i];
+		}
+
+		// The potential is only known after the first step:
+		PhysVal_t startEnergy = 0.0;
+		for (size_t step = 0; step < steps; ++step)
 		{
-			collideOneMoleculeBarnesHut(i, 0, 0);
-			attractOneMoleculeBarnesHut(i, 0, 0);
+			copy.iterationCycle();
+
+			PhysVal_t kineticEnergy, potentialEnergy;
+			copy.measureEnergy(kineticEnergy, potentialEnergy);
+
+			if (step == 0) startEnergy = kineticEnergy + potentialEnergy;
+			else drifts[copyPrecision] = std::fmax(drifts[copyPrecision],
+			                                       std::fabs(kineticEnergy + potentialEnergy - startEnergy) / std::fabs(startEnergy));
 		}
 	}
+
+	printf("Energy drift over %zu steps: worst %.3e in double precision, %.3e in mixed precision\n",
+	       steps, drifts[DOUBLE_PRECISION], drifts[MIXED_PRECISION]);
+
+	return drifts[MIXED_PRECISION];
+}
+
+void GasModel::setPotentialEvaluation(PotentialEvaluation evaluation, size_t tableIntervals)
+{
+	delete lennardJonesTable;
+	lennardJonesTable = nullptr;
+
+	if (evaluation == TABULATED_POTENTIAL)
+		lennardJonesTable = new LennardJonesTable(tableIntervals);
+}
+
+char GasModel::calculateOct(size_t moleculeI, int curI) const
+{
+	return ((molecules[moleculeI].coords.x > octTree[curI].center[0]) ? 4 : 0) +
+	       ((molecules[moleculeI].coords.y > octTree[curI].center[1]) ? 2 : 0) + 
+	       ((molecules[moleculeI].coords.z > octTree[curI].center[2]) ? 1 : 0);
 }
 
 //==============================================
-// INTERACTION CYCLE
+// MORTON ORDER
 //==============================================
 
-void GasModel::iterationCycle()
+uint64_t spreadMortonBits(uint64_t bits)
 {
-	for (size_t i = 0; i < moleculeCount; ++i)
-		molecules[i].integrationStep();
+	bits &= 0x1fffff;
+	bits = (bits | bits << 32) & 0x001f00000000ffff;
+	bits = (bits | bits << 16) & 0x001f0000ff0000ff;
+	bits = (bits | bits <<  8) & 0x100f00f00f00f00f;
+	bits = (bits | bits <<  4) & 0x10c30c30c30c30c3;
+	bits = (bits | bits <<  2) & 0x1249249249249249;
 
-	interactWithEachOther();
+	return bits;
+}
 
-	for (size_t i = 0; i < moleculeCount; ++i)
-		box.moleculeBounce(molecules[i]);
+uint64_t quantizeMortonCoord(PhysVal_t coord, PhysVal_t boxSize)
+{
+	const PhysVal_t cells = 1 << MORTON_DEPTH;
+
+	PhysVal_t scaled = coord / boxSize * cells;
+	if (scaled <= 0.0)   return 0;
+	if (scaled >= cells) return (1 << MORTON_DEPTH) - 1;
+
+	return scaled;
 }
 
-//==============================================
-// ENERGY LOSS FIX-UP
-//==============================================
+char mortonDigit(uint64_t key, unsigned level)
+{
+	return (key >> (3 * (MORTON_DEPTH - 1 - level))) & 7;
+}
 
-void GasModel::fixEnergy()
+size_t GasModel::mortonChunkCount() const
 {
-	// Calculate Fix-Up factor:
-	PhysVal_t currKineticEnergy = 0.0;
-	for (size_t i = 0; i < moleculeCount; ++i)
+	size_t chunks = (moleculeCount + MORTON_CHUNK - 1) / MORTON_CHUNK;
+	return (chunks < MAX_MORTON_CHUNKS)? chunks : MAX_MORTON_CHUNKS;
+}
+
+void GasModel::computeMortonKeys()
+{
+	size_t chunkCount = mortonChunkCount();
+	size_t chunkSize  = (moleculeCount + chunkCount - 1) / chunkCount;
+
+	threadPool->parallelFor(chunkCount, [this, chunkSize](size_t chunkI, size_t)
 	{
-		currPotentialEnergy += MASSES[molecules[i].type] * GRAVITY * molecules[i].coords.z;
+		size_t last = std::min(moleculeCount, (chunkI + 1) * chunkSize);
+		for (size_t i = chunkI * chunkSize; i < last; ++i)
+		{
+			const Vector& coords = molecules[i].coords;
 
-		currKineticEnergy += MASSES[molecules[i].type] * molecules[i].speed.lenSqr();
-	}
+			mortonKeys[i] = spreadMortonBits(quantizeMortonCoord(coords.x, box.containerSize.x)) << 2 |
+			                spreadMortonBits(quantizeMortonCoord(coords.y, box.containerSize.y)) << 1 |
+			                spreadMortonBits(quantizeMortonCoord(coords.z, box.containerSize.z));
+			mortonOrder[i] = i;
+		}
+	});
+}
 
-	if (prevTotalEnergyCalculated)
+// Stable LSD radix sort, every pass histograms and scatters chunks in parallel
+void GasModel::sortMortonKeys()
+{
+	size_t chunkCount = mortonChunkCount();
+	size_t chunkSize  = (moleculeCount + chunkCount - 1) / chunkCount;
+
+	for (unsigned shift = 0; shift < 3 * MORTON_DEPTH; shift += RADIX_BITS)
 	{
-		PhysVal_t fixupFactor = std::sqrt((prevTotalEnergy - currPotentialEnergy)/currKineticEnergy);
+		threadPool->parallelFor(chunkCount, [this, chunkSize, shift](size_t chunkI, size_t)
+		{
+			size_t* histogram = radixHistograms + chunkI * RADIX_BUCKETS;
+			for (size_t bucket = 0; bucket < RADIX_BUCKETS; ++bucket)
+				histogram[bucket] = 0;
+
+			size_t last = std::min(moleculeCount, (chunkI + 1) * chunkSize);
+			for (size_t i = chunkI * chunkSize; i < last; ++i)
+				histogram[(mortonKeys[i] >> shift) & (RADIX_BUCKETS - 1)] += 1;
+		});
+
+		// Turn counts into scatter offsets, bucket-major then chunk-major:
+		size_t offset = 0;
+		bool allInOneBucket = false;
+		for (size_t bucket = 0; bucket < RADIX_BUCKETS; ++bucket)
+		{
+			size_t bucketStart = offset;
+			for (size_t chunkI = 0; chunkI < chunkCount; ++chunkI)
+			{
+				size_t count = radixHistograms[chunkI * RADIX_BUCKETS + bucket];
+				radixHistograms[chunkI * RADIX_BUCKETS + bucket] = offset;
+				offset += count;
+			}
+
+			if (offset - bucketStart == moleculeCount) allInOneBucket = true;
+		}
 
-		for (size_t i = 0; i < moleculeCount; ++i) 
-			molecules[i].speed *= fixupFactor;
+		// Nothing to reorder by this digit:
+		if (allInOneBucket) continue;
+
+		threadPool->parallelFor(chunkCount, [this, chunkSize, shift](size_t chunkI, size_t)
+		{
+			size_t* offsets = radixHistograms + chunkI * RADIX_BUCKETS;
+
+			size_t last = std::min(moleculeCount, (chunkI + 1) * chunkSize);
+			for (size_t i = chunkI * chunkSize; i < last; ++i)
+			{
+				size_t dest = offsets[(mortonKeys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+
+				mortonKeysScratch [dest] = mortonKeys [i];
+				mortonOrderScratch[dest] = mortonOrder[i];
+			}
+		});
+
+		std::swap(mortonKeys,  mortonKeysScratch);
+		std::swap(mortonOrder, mortonOrderScratch);
 	}
+}
 
-	prevTotalEnergy = currKineticEnergy + currPotentialEnergy;
-	currPotentialEnergy = 0.0;
+// Number of leading octal digits the two keys share
+unsigned mortonSharedDigits(uint64_t keyA, uint64_t keyB)
+{
+	uint64_t difference = keyA ^ keyB;
+	if (difference == 0) return MORTON_DEPTH;
 
-	prevTotalEnergyCalculated = true;
+	unsigned highestBit = 63 - __builtin_clzll(difference);
+	return MORTON_DEPTH - 1 - highestBit / 3;
+}
+
+// Number of leading octal digits shared by sorted keys sortedI - 1 and sortedI
+unsigned GasModel::mortonCommonDepth(size_t sortedI) const
+{
+	if (sortedI == 0 || sortedI >= moleculeCount) return 0;
+
+	return mortonSharedDigits(mortonKeys[sortedI - 1], mortonKeys[sortedI]);
+}
+
+//==============================================
+// LINEAR OCT-TREE CONSTRUCTION
+//==============================================
+
+// Molecules with equal keys can not be told apart by any level, so they share a leaf.
+// Runs of them are handled like a single molecule.
+size_t GasModel::equalKeysEnd(size_t sortedI, size_t last) const
+{
+	for (++sortedI; sortedI < last && mortonCommonDepth(sortedI) == MORTON_DEPTH; ++sortedI);
+
+	return sortedI;
+}
+
+// A leaf sits one level below the deepest prefix it shares with a sorted neighbour.
+// Every leaf adds the nodes between the prefix shared with its predecessor and itself.
+size_t GasModel::countOctantNodes(size_t first, size_t last, size_t& degenerateLeaves) const
+{
+	size_t nodes = 0;
+	degenerateLeaves = 0;
+
+	for (size_t sortedI = first, groupEnd; sortedI < last; sortedI = groupEnd)
+	{
+		groupEnd = equalKeysEnd(sortedI, last);
+
+		unsigned shared    = (sortedI == first)? 0 : mortonCommonDepth(sortedI);
+		unsigned leafDepth = std::max(mortonCommonDepth(sortedI), mortonCommonDepth(groupEnd)) + 1;
+
+		nodes += leafDepth - shared;
+		if (groupEnd - sortedI > 1) ++degenerateLeaves;
+	}
+
+	return nodes;
+}
+
+// One sweep over the sorted molecules of a root octant with a stack of currently open nodes
+void GasModel::buildOctant(size_t first, size_t last, int nodeI)
+{
+	int    openNodes  [MORTON_DEPTH + 1];
+	size_t openFirst  [MORTON_DEPTH + 1];
+	Vector openCenters[MORTON_DEPTH + 1];
+
+	openNodes  [0] = 0;
+	openCenters[0] = sizeAtDepth[0];
+	unsigned top = 0;
+
+	for (size_t sortedI = first, groupEnd; sortedI < last; sortedI = groupEnd)
+	{
+		groupEnd = equalKeysEnd(sortedI, last);
+
+		// Molecules of a leaf are chained in sorted order:
+		for (size_t groupI = sortedI + 1; groupI < groupEnd; ++groupI)
+			octTreeNext[mortonOrder[groupI - 1]] = mortonOrder[groupI];
+		octTreeNext[mortonOrder[groupEnd - 1]] = -1;
+
+		unsigned shared    = (sortedI == first)? 0 : mortonCommonDepth(sortedI);
+		unsigned leafDepth = std::max(mortonCommonDepth(sortedI), mortonCommonDepth(groupEnd)) + 1;
+
+		// Nodes below the shared prefix will get no more molecules:
+		for (; top > shared; --top)
+			octTreeBuild[openNodes[top]].count = sortedI - openFirst[top];
+
+		for (unsigned depth = shared + 1; depth <= leafDepth; ++depth, ++nodeI)
+		{
+			int  prevI = openNodes[depth - 1];
+			char oct   = mortonDigit(mortonKeys[sortedI], depth - 1);
+
+			Vector curCenter = {sizeAtDepth[depth].x * ((oct & 0b00000100)? 1.0 : -1.0),
+			                    sizeAtDepth[depth].y * ((oct & 0b00000010)? 1.0 : -1.0),
+			                    sizeAtDepth[depth].z * ((oct & 0b00000001)? 1.0 : -1.0)};
+
+			curCenter += openCenters[depth - 1];
+			openCenters[depth] = curCenter;
+
+			int moleculeI = (depth == leafDepth)? mortonOrder[sortedI] : -1;
+			octTreeBuild[nodeI].initNode(moleculeI, 1, curCenter, depth, oct);
+			octTreeBuildParents[nodeI] = prevI;
+
+			// The root is shared by all octants and gets its children in buildOctTree:
+			if (prevI != 0) octTreeBuild[prevI].childMask |= 1 << oct;
+
+			openNodes[depth] = nodeI;
+			openFirst[depth] = sortedI;
+			top = depth;
+		}
+	}
+
+	for (; top > 0; --top)
+		octTreeBuild[openNodes[top]].count = last - openFirst[top];
+}
+
+// Moves the tree from build order into one where the children of every node lie one after
+// another. Children of node n end up at octTreeChildStarts[n] onwards, in order of octants.
+void GasModel::packOctTree()
+{
+	size_t chunkSize  = MORTON_CHUNK;
+	size_t chunkCount = (octTreeSize + chunkSize - 1) / chunkSize;
+	if (chunkCount > MAX_MORTON_CHUNKS)
+	{
+		chunkCount = MAX_MORTON_CHUNKS;
+		chunkSize  = (octTreeSize + chunkCount - 1) / chunkCount;
+	}
+
+	// Exclusive scan over child counts, chunk sums first:
+	size_t chunkChildren[MAX_MORTON_CHUNKS];
+	threadPool->parallelFor(chunkCount, [this, chunkSize, &chunkChildren](size_t chunkI, size_t)
+	{
+		size_t children = 0;
+
+		size_t last = std::min(octTreeSize, (chunkI + 1) * chunkSize);
+		for (size_t nodeI = chunkI * chunkSize; nodeI < last; ++nodeI)
+			children += octTreeBuild[nodeI].childCount();
+
+		chunkChildren[chunkI] = children;
+	});
+
+	for (size_t chunkI = 0, start = 1; chunkI < chunkCount; ++chunkI)
+	{
+		size_t children = chunkChildren[chunkI];
+		chunkChildren[chunkI] = start;
+		start += children;
+	}
+
+	threadPool->parallelFor(chunkCount, [this, chunkSize, &chunkChildren](size_t chunkI, size_t)
+	{
+		size_t start = chunkChildren[chunkI];
+
+		size_t last = std::min(octTreeSize, (chunkI + 1) * chunkSize);
+		for (size_t nodeI = chunkI * chunkSize; nodeI < last; ++nodeI)
+		{
+			octTreeChildStarts[nodeI] = start;
+			start += octTreeBuild[nodeI].childCount();
+		}
+	});
+
+	// A node's new place follows from its parent's child start and its octant:
+	auto packedIndex = [this](int buildI)
+	{
+		if (buildI == 0) return 0;
+
+		const OctTreeNode& parent = octTreeBuild[octTreeBuildParents[buildI]];
+		return octTreeChildStarts[octTreeBuildParents[buildI]] + (int) parent.childRank(octTreeBuild[buildI].octant);
+	};
+
+	threadPool->parallelFor(chunkCount, [this, chunkSize, &packedIndex](size_t chunkI, size_t)
+	{
+		size_t last = std::min(octTreeSize, (chunkI + 1) * chunkSize);
+		for (size_t nodeI = chunkI * chunkSize; nodeI < last; ++nodeI)
+		{
+			int packedI = packedIndex(nodeI);
+
+			octTree[packedI] = octTreeBuild[nodeI];
+			octTree[packedI].firstChild = octTreeBuild[nodeI].childMask? octTreeChildStarts[nodeI] : -1;
+
+			octTreeParents[packedI] = (nodeI == 0)? -1 : packedIndex(octTreeBuildParents[nodeI]);
+
+			for (int moleculeI = octTree[packedI].molecule; moleculeI != -1; moleculeI = octTreeNext[moleculeI])
+				octTreeLeaves[moleculeI] = packedI;
+		}
+	});
+}
+
+void GasModel::buildOctTree()
+{
+	octTreeSize = 0;
+	octTreeRefittable = false;
+	octTreeGarbage    = 0;
+	octTreeDegenerateLeaves = 0;
+
+	if (moleculeCount == 0) return;
+
+	computeMortonKeys();
+	sortMortonKeys();
+
+	// A lone molecule, or molecules that no level can tell apart, make the root a leaf:
+	if (mortonKeys[0] == mortonKeys[moleculeCount - 1])
+	{
+		for (size_t sortedI = 0; sortedI < moleculeCount; ++sortedI)
+		{
+			octTreeNext  [mortonOrder[sortedI]] = (sortedI + 1 < moleculeCount)? mortonOrder[sortedI + 1] : -1;
+			octTreeLeaves[mortonOrder[sortedI]] = 0;
+		}
+
+		octTree[0].initNode(mortonOrder[0], moleculeCount, sizeAtDepth[0], 0, 0);
+		octTreeParents[0] = -1;
+		octTreeSize = 1;
+
+		if (moleculeCount > 1) octTreeDegenerateLeaves = 1;
+	}
+	else buildOctTreeNodes();
+
+	if (octTreeDegenerateLeaves != 0) ++octTreeDegenerateUpdates;
+
+	if (octTreeUpdate == REFIT_OCT_TREE)
+	{
+		// Keys go back to molecule order for the next refit to compare against:
+		size_t chunkCount = mortonChunkCount();
+		size_t chunkSize  = (moleculeCount + chunkCount - 1) / chunkCount;
+
+		threadPool->parallelFor(chunkCount, [this, chunkSize](size_t chunkI, size_t)
+		{
+			size_t last = std::min(moleculeCount, (chunkI + 1) * chunkSize);
+			for (size_t sortedI = chunkI * chunkSize; sortedI < last; ++sortedI)
+				octTreeKeys[mortonOrder[sortedI]] = mortonKeys[sortedI];
+		});
+
+		octTreeRefittable    = true;
+		octTreeMoleculeCount = moleculeCount;
+	}
+}
+
+// Builds the tree from sorted keys that are not all equal, so the root has children
+void GasModel::buildOctTreeNodes()
+{
+	// Root octants are independent subtrees:
+	size_t octantStarts[9];
+	for (size_t oct = 0, sortedI = 0; oct < 8; ++oct)
+	{
+		octantStarts[oct] = sortedI;
+		while (sortedI < moleculeCount && (size_t) mortonDigit(mortonKeys[sortedI], 0) == oct) ++sortedI;
+	}
+	octantStarts[8] = moleculeCount;
+
+	size_t octantNodes[8];
+	size_t octantDegenerateLeaves[8];
+	threadPool->parallelFor(8, [this, &octantStarts, &octantNodes, &octantDegenerateLeaves](size_t oct, size_t)
+	{
+		octantNodes[oct] = countOctantNodes(octantStarts[oct], octantStarts[oct + 1], octantDegenerateLeaves[oct]);
+	});
+
+	size_t octantFirstNodes[8];
+	octTreeSize = 1;
+	for (size_t oct = 0; oct < 8; ++oct)
+	{
+		octantFirstNodes[oct] = octTreeSize;
+		octTreeSize += octantNodes[oct];
+		octTreeDegenerateLeaves += octantDegenerateLeaves[oct];
+	}
+
+	// Grown with some slack, so that the tree does not reallocate every step:
+	if (octTreeSize > octTreeCapacity) reserveOctTree(octTreeSize + octTreeSize / 4, 0);
+
+	octTreeBuild[0].initNode(-1, moleculeCount, sizeAtDepth[0], 0, 0);
+	octTreeBuildParents[0] = -1;
+
+	for (size_t oct = 0; oct < 8; ++oct)
+	{
+		if (octantNodes[oct] != 0) octTreeBuild[0].childMask |= 1 << oct;
+	}
+
+	threadPool->parallelFor(8, [this, &octantStarts, &octantFirstNodes](size_t oct, size_t)
+	{
+		buildOctant(octantStarts[oct], octantStarts[oct + 1], octantFirstNodes[oct]);
+	});
+
+	packOctTree();
+}
+
+//==============================================
+// INCREMENTAL OCT-TREE REFIT
+//==============================================
+// The tree holds a node for every Morton cell with two or more distinct keys and a leaf for every
+// key one level below the last of them. That shape depends on the keys alone, so moving the
+// molecules that left their leaf's cell one by one gives the tree a rebuild would.
+
+// Summed up in the same order as in buildOctant, so that centers come out bit for bit the same
+Vector GasModel::octTreeCellCenter(uint64_t key, unsigned depth) const
+{
+	Vector center = sizeAtDepth[0];
+
+	for (unsigned level = 1; level <= depth; ++level)
+	{
+		char oct = mortonDigit(key, level - 1);
+
+		Vector offset = {sizeAtDepth[level].x * ((oct & 0b00000100)? 1.0 : -1.0),
+		                 sizeAtDepth[level].y * ((oct & 0b00000010)? 1.0 : -1.0),
+		                 sizeAtDepth[level].z * ((oct & 0b00000001)? 1.0 : -1.0)};
+
+		offset += center;
+		center = offset;
+	}
+
+	return center;
+}
+
+// Gives a node a fresh block of children for the new child mask and returns where it starts.
+// Children kept by the mask are copied over, new ones are left for the caller to fill.
+// The old block is abandoned until the next rebuild.
+int GasModel::moveOctTreeChildren(int nodeI, unsigned newMask)
+{
+	OctTreeNode& node = octTree[nodeI];
+
+	int      oldFirst = node.firstChild;
+	unsigned oldMask  = node.childMask;
+	octTreeGarbage += node.childCount();
+
+	node.childMask  = newMask;
+	node.firstChild = newMask? octTreeSize : -1;
+	octTreeSize += node.childCount();
+
+	for (unsigned oct = 0; oct < 8; ++oct)
+	{
+		if (!(oldMask & newMask & (1u << oct))) continue;
+
+		int fromI = oldFirst + __builtin_popcount(oldMask & ((1u << oct) - 1));
+		int toI   = node.firstChild + node.childRank(oct);
+
+		octTree[toI] = octTree[fromI];
+		octTreeParents[toI] = nodeI;
+
+		// Everything that points at the child follows it:
+		const OctTreeNode& moved = octTree[toI];
+		for (int moleculeI = moved.molecule; moleculeI != -1; moleculeI = octTreeNext[moleculeI])
+			octTreeLeaves[moleculeI] = toI;
+
+		for (int childI = moved.firstChild; childI < moved.firstChild + (int) moved.childCount(); ++childI)
+			octTreeParents[childI] = toI;
+	}
+
+	return node.firstChild;
+}
+
+// Counts drop along the whole path. A leaf with other molecules of the same key stays.
+// Otherwise a sibling leaf left alone moves up to the highest node above it with nothing else.
+void GasModel::removeFromOctTree(size_t moleculeI)
+{
+	int leafI = octTreeLeaves[moleculeI];
+	OctTreeNode& leaf = octTree[leafI];
+
+	for (int nodeI = leafI; nodeI != -1; nodeI = octTreeParents[nodeI])
+		octTree[nodeI].count -= 1;
+
+	if (leaf.count != 0)
+	{
+		int* link = &leaf.molecule;
+		while (*link != (int) moleculeI) link = &octTreeNext[*link];
+		*link = octTreeNext[moleculeI];
+
+		if (leaf.count == 1) --octTreeDegenerateLeaves;
+		return;
+	}
+
+	// A leaf always has a sibling, its parent would not tell anything apart otherwise:
+	int parentI = octTreeParents[leafI];
+	OctTreeNode& parent = octTree[parentI];
+
+	unsigned remainingMask = parent.childMask & ~(1u << leaf.octant);
+	int      remainingI    = parent.firstChild + ((parent.firstChild == leafI)? 1 : 0);
+
+	if (__builtin_popcount(remainingMask) > 1 || octTree[remainingI].childMask != 0)
+	{
+		moveOctTreeChildren(parentI, remainingMask);
+		return;
+	}
+
+	int collapseI = parentI;
+	while (octTreeParents[collapseI] != -1 && octTree[octTreeParents[collapseI]].childCount() == 1)
+		collapseI = octTreeParents[collapseI];
+
+	OctTreeNode& collapsed = octTree[collapseI];
+	octTreeGarbage += parent.depth - collapsed.depth + 2;
+
+	collapsed.molecule   = octTree[remainingI].molecule;
+	collapsed.firstChild = -1;
+	collapsed.childMask  = 0;
+
+	for (int remainingMoleculeI = collapsed.molecule; remainingMoleculeI != -1; remainingMoleculeI = octTreeNext[remainingMoleculeI])
+		octTreeLeaves[remainingMoleculeI] = collapseI;
+}
+
+// Follows the molecule's key down from the root. A leaf with the same key takes the molecule in,
+// in index order like a rebuild does. A leaf with another key is split until the two keys part.
+void GasModel::insertIntoOctTree(size_t moleculeI)
+{
+	uint64_t key = octTreeKeys[moleculeI];
+
+	int nodeI = 0;
+	while (octTree[nodeI].childMask != 0)
+	{
+		OctTreeNode& node = octTree[nodeI];
+		node.count += 1;
+
+		unsigned oct = mortonDigit(key, node.depth);
+		if (node.childMask & (1u << oct))
+		{
+			nodeI = node.firstChild + node.childRank(oct);
+			continue;
+		}
+
+		int leafI = moveOctTreeChildren(nodeI, node.childMask | (1u << oct)) + node.childRank(oct);
+
+		octTree[leafI].initNode(moleculeI, 1, octTreeCellCenter(key, node.depth + 1), node.depth + 1, oct);
+		octTreeParents[leafI] = nodeI;
+		octTreeLeaves[moleculeI] = leafI;
+		octTreeNext  [moleculeI] = -1;
+		return;
+	}
+
+	OctTreeNode& leaf = octTree[nodeI];
+
+	int      otherI   = leaf.molecule;
+	uint64_t otherKey = octTreeKeys[otherI];
+	unsigned shared   = mortonSharedDigits(key, otherKey);
+
+	if (shared == MORTON_DEPTH)
+	{
+		int* link = &leaf.molecule;
+		while (*link != -1 && *link < (int) moleculeI) link = &octTreeNext[*link];
+
+		octTreeNext[moleculeI] = *link;
+		*link = moleculeI;
+
+		leaf.count += 1;
+		if (leaf.count == 2) ++octTreeDegenerateLeaves;
+
+		octTreeLeaves[moleculeI] = nodeI;
+		return;
+	}
+
+	int otherCount = leaf.count;
+
+	leaf.molecule = -1;
+	leaf.count    = otherCount + 1;
+
+	for (unsigned depth = leaf.depth; depth < shared; ++depth)
+	{
+		unsigned oct = mortonDigit(key, depth);
+
+		int childI = moveOctTreeChildren(nodeI, 1u << oct);
+		octTree[childI].initNode(-1, otherCount + 1, octTreeCellCenter(key, depth + 1), depth + 1, oct);
+		octTreeParents[childI] = nodeI;
+
+		nodeI = childI;
+	}
+
+	unsigned oct      = mortonDigit(key,      shared);
+	unsigned otherOct = mortonDigit(otherKey, shared);
+	int firstI = moveOctTreeChildren(nodeI, (1u << oct) | (1u << otherOct));
+
+	int leafI      = firstI + octTree[nodeI].childRank(oct);
+	int otherLeafI = firstI + octTree[nodeI].childRank(otherOct);
+
+	octTree[leafI]     .initNode(moleculeI, 1,          octTreeCellCenter(key,      shared + 1), shared + 1, oct);
+	octTree[otherLeafI].initNode(otherI,    otherCount, octTreeCellCenter(otherKey, shared + 1), shared + 1, otherOct);
+
+	octTreeParents[leafI]      = nodeI;
+	octTreeParents[otherLeafI] = nodeI;
+	octTreeLeaves[moleculeI] = leafI;
+	octTreeNext  [moleculeI] = -1;
+
+	for (int otherMoleculeI = otherI; otherMoleculeI != -1; otherMoleculeI = octTreeNext[otherMoleculeI])
+		octTreeLeaves[otherMoleculeI] = otherLeafI;
+}
+
+// Moves the molecules that left the cell of their leaf. Returns false when a rebuild is due instead.
+bool GasModel::refitOctTree()
+{
+	if (!octTreeRefittable || octTreeMoleculeCount != moleculeCount) return false;
+
+	// Abandoned blocks and children far from their parents only go away with a rebuild:
+	if (OCT_TREE_REFIT_GARBAGE_LIMIT * octTreeGarbage > octTreeSize - octTreeGarbage) return false;
+
+	computeMortonKeys();
+
+	// Molecules that stay only update their keys. The rest are listed chunk by chunk
+	// in the sort scratch, which is free between rebuilds:
+	size_t chunkCount = mortonChunkCount();
+	size_t chunkSize  = (moleculeCount + chunkCount - 1) / chunkCount;
+
+	threadPool->parallelFor(chunkCount, [this, chunkSize](size_t chunkI, size_t)
+	{
+		size_t moved = chunkI * chunkSize;
+
+		size_t last = std::min(moleculeCount, (chunkI + 1) * chunkSize);
+		for (size_t i = chunkI * chunkSize; i < last; ++i)
+		{
+			const OctTreeNode& leaf = octTree[octTreeLeaves[i]];
+
+			// Molecules sharing a leaf have to keep sharing the key:
+			uint64_t keyChange = mortonKeys[i] ^ octTreeKeys[i];
+			if (leaf.count == 1) keyChange >>= 3 * (MORTON_DEPTH - leaf.depth);
+
+			if (keyChange != 0)
+				mortonOrderScratch[moved++] = i;
+			else
+				octTreeKeys[i] = mortonKeys[i];
+		}
+
+		radixHistograms[chunkI] = moved;
+	});
+
+	size_t moves = 0;
+	for (size_t chunkI = 0; chunkI < chunkCount; ++chunkI)
+		moves += radixHistograms[chunkI] - chunkI * chunkSize;
+
+	if (OCT_TREE_REFIT_MOVES_LIMIT * moves > moleculeCount) return false;
+
+	size_t nodes = octTreeSize + moves * OCT_TREE_NODES_PER_MOVE;
+	if (nodes > octTreeCapacity) reserveOctTree(nodes + nodes / 4, octTreeSize);
+
+	for (size_t chunkI = 0; chunkI < chunkCount; ++chunkI)
+	{
+		for (size_t movedI = chunkI * chunkSize; movedI < radixHistograms[chunkI]; ++movedI)
+		{
+			size_t moleculeI = mortonOrderScratch[movedI];
+
+			removeFromOctTree(moleculeI);
+			octTreeKeys[moleculeI] = mortonKeys[moleculeI];
+			insertIntoOctTree(moleculeI);
+		}
+	}
+
+	if (octTreeDegenerateLeaves != 0) ++octTreeDegenerateUpdates;
+
+	return true;
+}
+
+void GasModel::updateOctTree()
+{
+	if (octTreeUpdate == REFIT_OCT_TREE && refitOctTree()) return;
+
+	buildOctTree();
+}
+
+//==============================================
+// BARNES-HUT MULTIPOLES
+//==============================================
+
+// Masses for gravity, charges for Coulomb
+PhysVal_t GasModel::longRangeStrength(size_t moleculeI) const
+{
+	return (longRangeForce == SELF_GRAVITY)? MASSES[molecules[moleculeI].type] : CHARGES[molecules[moleculeI].type];
+}
+
+void GasModel::computeMultipole(int nodeI)
+{
+	const OctTreeNode& node = octTree[nodeI];
+
+	if (node.childMask == 0)
+	{
+		Multipole& multipole = octTreeMultipoles[nodeI];
+		multipole.initSource(molecules[node.molecule].coords, longRangeStrength(node.molecule));
+
+		// Molecules sharing the leaf are added one by one:
+		for (int moleculeI = octTreeNext[node.molecule]; moleculeI != -1; moleculeI = octTreeNext[moleculeI])
+		{
+			Multipole sources[2] = {multipole};
+			sources[1].initSource(molecules[moleculeI].coords, longRangeStrength(moleculeI));
+
+			multipole.combine(sources, 2, node.getCenter(), multipoleOrder);
+		}
+
+		return;
+	}
+
+	for (int childI = node.firstChild; childI < node.firstChild + (int) node.childCount(); ++childI)
+		computeMultipole(childI);
+
+	octTreeMultipoles[nodeI].combine(octTreeMultipoles + node.firstChild, node.childCount(), node.getCenter(), multipoleOrder);
+}
+
+// Subtrees of the root are summed up in parallel, the root gathers them
+void GasModel::buildMultipoles()
+{
+	const OctTreeNode& root = octTree[0];
+
+	if (root.childMask == 0)
+	{
+		computeMultipole(0);
+		return;
+	}
+
+	threadPool->parallelFor(root.childCount(), [this, &root](size_t childI, size_t)
+	{
+		computeMultipole(root.firstChild + childI);
+	});
+
+	octTreeMultipoles[0].combine(octTreeMultipoles + root.firstChild, root.childCount(), root.getCenter(), multipoleOrder);
+}
+
+// Nodes that do not hold the molecule and look narrower than the opening angle count as a whole.
+// Leaves are exact, since a single source sits at its own center.
+void GasModel::longRangeFieldBarnesHut(size_t moleculeI, Vector& field, PhysVal_t& potential) const
+{
+	const Vector& coords = molecules[moleculeI].coords;
+
+	field     = Vector(0.0, 0.0, 0.0);
+	potential = 0.0;
+
+	int stack[8 * OCT_TREE_MAX_DEPTH];
+
+	stack[0] = 0;
+	size_t top = 1;
+
+	while (top != 0)
+	{
+		int nodeI = stack[--top];
+
+		const OctTreeNode& node      = octTree[nodeI];
+		const Multipole&   multipole = octTreeMultipoles[nodeI];
+
+		// Nothing charged inside:
+		if (multipole.weight == 0.0) continue;
+
+		if (node.count == 1)
+		{
+			if (node.molecule != (int) moleculeI) multipole.addField(coords, multipoleOrder, field, potential);
+			continue;
+		}
+
+		// Molecules sharing a leaf are summed up exactly:
+		if (node.childMask == 0)
+		{
+			for (int sourceI = node.molecule; sourceI != -1; sourceI = octTreeNext[sourceI])
+			{
+				// Molecules right on top of each other exert nothing:
+				if (sourceI == (int) moleculeI || (coords - molecules[sourceI].coords).lenSqr() == 0.0) continue;
+
+				Multipole source;
+				source.initSource(molecules[sourceI].coords, longRangeStrength(sourceI));
+				source.addField(coords, DIPOLE_ORDER, field, potential);
+			}
+
+			continue;
+		}
+
+		const Vector& halfSize = sizeAtDepth[node.depth];
+		PhysVal_t width = 2 * std::max(halfSize.x, std::max(halfSize.y, halfSize.z));
+
+		bool far = width * width < openingAngle * openingAngle * (coords - multipole.center).lenSqr();
+		if (far && !(coords - node.getCenter()).isInBox(halfSize))
+		{
+			multipole.addField(coords, multipoleOrder, field, potential);
+			continue;
+		}
+
+		for (int childI = node.firstChild + node.childCount() - 1; childI >= node.firstChild; --childI)
+			stack[top++] = childI;
+	}
+}
+
+void GasModel::longRangeFieldNaive(size_t moleculeI, Vector& field, PhysVal_t& potential) const
+{
+	field     = Vector(0.0, 0.0, 0.0);
+	potential = 0.0;
+
+	for (size_t sourceI = 0; sourceI < moleculeCount; ++sourceI)
+	{
+		PhysVal_t strength = longRangeStrength(sourceI);
+		if (sourceI == moleculeI || strength == 0.0) continue;
+
+		Vector r = molecules[moleculeI].coords - molecules[sourceI].coords;
+		if (r.lenSqr() == 0.0) continue;
+
+		PhysVal_t invLenSqr = 1 / r.lenSqr();
+		PhysVal_t invLen    = std::sqrt(invLenSqr);
+
+		potential += strength * invLen;
+		field     += r * (strength * invLen * invLenSqr);
+	}
+}
+
+// Every molecule feels the field of all the others. The tree is the one of the short-range pass,
+// or one of its own for the other searches.
+void GasModel::interactLongRange()
+{
+	if (moleculeCount == 0) return;
+
+	if (neighborSearch != OCT_TREE_SEARCH) updateOctTree();
+
+	buildMultipoles();
+
+	// Uncharged molecules feel nothing:
+	if (octTreeMultipoles[0].weight == 0.0) return;
+
+	size_t chunkCount = mortonChunkCount();
+	size_t chunkSize  = (moleculeCount + chunkCount - 1) / chunkCount;
+
+	PhysVal_t chunkEnergy[MAX_MORTON_CHUNKS];
+	threadPool->parallelFor(chunkCount, [this, chunkSize, &chunkEnergy](size_t chunkI, size_t)
+	{
+		PhysVal_t energy = 0.0;
+
+		size_t last = std::min(moleculeCount, (chunkI + 1) * chunkSize);
+		for (size_t i = chunkI * chunkSize; i < last; ++i)
+		{
+			Vector field;
+			PhysVal_t potential;
+
+			longRangeFieldBarnesHut(i, field, potential);
+
+			PhysVal_t coupling = longRangeCoupling * longRangeStrength(i);
+
+			forces[i] += field * coupling;
+			energy    += potential * coupling;
+		}
+
+		chunkEnergy[chunkI] = energy;
+	});
+
+	// Every pair is seen from both ends:
+	for (size_t chunkI = 0; chunkI < chunkCount; ++chunkI)
+		currPotentialEnergy += 0.5 * chunkEnergy[chunkI];
+}
+
+PhysVal_t GasModel::reportLongRangeError(size_t samples)
+{
+	if (longRangeForce == NO_LONG_RANGE_FORCE || moleculeCount < 2 || samples == 0)
+	{
+		printf("GasModel::reportLongRangeError(): No long-range forces to compare\n");
+		return 0.0;
+	}
+
+	updateOctTree();
+	buildMultipoles();
+
+	// Potentials of mixed charges nearly cancel, so their errors are relative to the largest one:
+	PhysVal_t worstForceError     = 0.0, forceErrorSqr  = 0.0;
+	PhysVal_t worstPotentialError = 0.0, potentialScale = 0.0;
+	size_t    compared = 0;
+
+	size_t stride = std::max<size_t>(1, moleculeCount / samples);
+	for (size_t i = 0; i < moleculeCount; i += stride)
+	{
+		Vector    field,     exactField;
+		PhysVal_t potential, exactPotential;
+
+		longRangeFieldBarnesHut(i, field,      potential);
+		longRangeFieldNaive    (i, exactField, exactPotential);
+
+		worstPotentialError = std::fmax(worstPotentialError, std::fabs(potential - exactPotential));
+		potentialScale      = std::fmax(potentialScale,      std::fabs(exactPotential));
+
+		// Nothing to be relative to:
+		if (exactField.lenSqr() == 0.0) continue;
+
+		PhysVal_t forceError = (field - exactField).length() / exactField.length();
+
+		worstForceError = std::fmax(worstForceError, forceError);
+		forceErrorSqr += forceError * forceError;
+		++compared;
+	}
+
+	printf("Barnes-Hut long-range forces: opening angle %.2f, %s, %zu molecules compared\n", openingAngle,
+	       (multipoleOrder == QUADRUPOLE_ORDER)? "quadrupoles" : "dipoles", compared);
+
+	if (compared == 0) return 0.0;
+
+	printf("    force error: worst %.3e, rms %.3e\n", worstForceError, std::sqrt(forceErrorSqr / compared));
+	printf("    potential error: worst %.3e of the largest potential\n", worstPotentialError / potentialScale);
+
+	return worstForceError;
+}
+
+//==============================================
+// MOLECULE INTERACTION
+//==============================================
+
+// Every leaf within the interaction range of the molecule, walked with an explicit stack.
+// The molecule's coordinates are re-read at every node, since collisions shift it during the walk.
+template<typename Func>
+void GasModel::forEachTreeNeighbor(int moleculeI, Func func)
+{
+	// Node centers are floats, the slack covers their rounding:
+	const Vector MAX_INTERACTION_BOX_SIZE = Vector(interactionRange, interactionRange, interactionRange) +
+	                                        box.containerSize * TREE_CENTER_SLACK;
+
+	// At most seven siblings wait on every level above the current node:
+	int stack[8 * OCT_TREE_MAX_DEPTH];
+
+	size_t ownCount = moleculeCount - ghostCount;
+	bool   periodic = box.isPeriodic();
+
+	stack[0] = 0;
+	size_t top = 1;
+
+	while (top != 0)
+	{
+		const OctTreeNode& cur = octTree[stack[--top]];
+
+		// The nearest image of the node center is also the nearest image of the node:
+		Vector toCenter = cur.getCenter() - molecules[moleculeI].coords;
+		if (periodic) toCenter = nearestImage(toCenter, box.period);
+
+		if (!toCenter.isInBox(sizeAtDepth[cur.depth] + MAX_INTERACTION_BOX_SIZE)) continue;
+
+		if (cur.count == 1)
+		{
+			if (visitsPair(moleculeI, cur.molecule, ownCount)) func(cur.molecule);
+			continue;
+		}
+
+		// Molecules no level can tell apart share a leaf:
+		if (cur.childMask == 0)
+		{
+			for (int partnerI = cur.molecule; partnerI != -1; partnerI = octTreeNext[partnerI])
+			{
+				if (visitsPair(moleculeI, partnerI, ownCount)) func(partnerI);
+			}
+
+			continue;
+		}
+
+		// Pushed in reverse, so that octants are visited in ascending order:
+		for (int childI = cur.firstChild + cur.childCount() - 1; childI >= cur.firstChild; --childI)
+			stack[top++] = childI;
+	}
+}
+
+// Ghosts collide with own molecules only, and are thrown away after the pass
+inline bool GasModel::isGhost(size_t moleculeI) const
+{
+	return moleculeI >= moleculeCount - ghostCount;
+}
+
+// One walk with the larger of the two cutoffs handles both collisions and attraction
+template<typename Gas>
+void GasModel::interactOneMoleculeBarnesHut(PhysVal_t& potEnergy, size_t moleculeI)
+{
+	forEachTreeNeighbor(moleculeI, [this, &potEnergy, moleculeI](size_t partnerI)
+	{
+		moleculesCollide<Gas>(molecules[moleculeI], molecules[partnerI], box, isGhost(moleculeI));
+
+		if constexpr (Gas::ATTRACTS)
+			moleculesAttract<Gas>(potEnergy, molecules[moleculeI], molecules[partnerI], forces[moleculeI], forces[partnerI],
+			                      box.period, attractionShell, lennardJonesTable);
+	});
+}
+
+template<typename Gas>
+void GasModel::interactOneMoleculeCellList(PhysVal_t& potEnergy, size_t moleculeI)
+{
+	cellList->forEachNeighbor(molecules, moleculeI, moleculeCount - ghostCount, [this, &potEnergy, moleculeI](size_t partnerI)
+	{
+		moleculesCollide<Gas>(molecules[moleculeI], molecules[partnerI], box, isGhost(moleculeI));
+
+		if constexpr (Gas::ATTRACTS)
+			moleculesAttract<Gas>(potEnergy, molecules[moleculeI], molecules[partnerI], forces[moleculeI], forces[partnerI],
+			                      box.period, attractionShell, lennardJonesTable);
+	});
+}
+
+// Inner steps of multiple time stepping only take the partners listed as inner ones
+inline size_t GasModel::verletPartnersEnd(size_t moleculeI) const
+{
+	bool innerPass = outerShellSteps > 1 && attractionShell.fromSqr < 0.0;
+	return innerPass? neighborList->innerEnds[moleculeI] : neighborList->starts[moleculeI + 1];
+}
+
+template<typename Gas>
+void GasModel::interactOneMoleculeVerletList(PhysVal_t& potEnergy, size_t moleculeI)
+{
+	for (size_t i = neighborList->starts[moleculeI]; i < verletPartnersEnd(moleculeI); ++i)
+	{
+		size_t partnerI = neighborList->neighbors[i];
+
+		moleculesCollide<Gas>(molecules[moleculeI], molecules[partnerI], box, isGhost(moleculeI));
+
+		if constexpr (Gas::ATTRACTS)
+			moleculesAttract<Gas>(potEnergy, molecules[moleculeI], molecules[partnerI], forces[moleculeI], forces[partnerI],
+			                      box.period, attractionShell, lennardJonesTable);
+	}
+}
+
+// Partners of a molecule are gathered into one flat list for the array kernels
+thread_local std::vector<size_t> partnerScratch;
+
+template<typename Gas>
+void GasModel::interactOneMoleculeArrays(PhysVal_t& potEnergy, size_t moleculeI)
+{
+	const size_t* partners     = partnerScratch.data();
+	size_t        partnerCount = 0;
+
+	if (neighborSearch == VERLET_LIST_SEARCH)
+	{
+		partners     = neighborList->neighbors + neighborList->starts[moleculeI];
+		partnerCount = verletPartnersEnd(moleculeI) - neighborList->starts[moleculeI];
+	}
+	else
+	{
+		partnerScratch.clear();
+
+		if (neighborSearch == CELL_LIST_SEARCH)
+			cellList->forEachNeighbor(molecules, moleculeI, moleculeCount - ghostCount, [](size_t partnerI) { partnerScratch.push_back(partnerI); });
+		else
+			forEachTreeNeighbor(moleculeI, [](size_t partnerI) { partnerScratch.push_back(partnerI); });
+
+		partners     = partnerScratch.data();
+		partnerCount = partnerScratch.size();
+	}
+
+	if (precision == MIXED_PRECISION)
+	{
+		packedCollideAll<Gas>(*moleculeArrays, molecules, moleculeI, partners, partnerCount, box, isGhost(moleculeI));
+		packedAttract<Gas>(potEnergy, *moleculeArrays, molecules, forces, moleculeI, partners, partnerCount, box.period,
+		                   attractionShell, lennardJonesTable);
+		return;
+	}
+
+	arraysCollideAll<Gas>(*moleculeArrays, moleculeI, partners, partnerCount, box, isGhost(moleculeI));
+	arraysAttract<Gas>(potEnergy, *moleculeArrays, moleculeI, partners, partnerCount, box.period, attractionShell,
+	                   lennardJonesTable);
+}
+
+void GasModel::loadMoleculeArrays()
+{
+	moleculeArrays->reserve(moleculeCount);
+
+	size_t chunkCount = mortonChunkCount();
+	size_t chunkSize  = (moleculeCount + chunkCount - 1) / chunkCount;
+
+	threadPool->parallelFor(chunkCount, [this, chunkSize](size_t chunkI, size_t)
+	{
+		moleculeArrays->load(molecules, forces, chunkI * chunkSize, std::min(moleculeCount, (chunkI + 1) * chunkSize));
+	});
+}
+
+void GasModel::storeMoleculeArrays()
+{
+	size_t chunkCount = mortonChunkCount();
+	size_t chunkSize  = (moleculeCount + chunkCount - 1) / chunkCount;
+
+	threadPool->parallelFor(chunkCount, [this, chunkSize](size_t chunkI, size_t)
+	{
+		moleculeArrays->store(molecules, forces, chunkI * chunkSize, std::min(moleculeCount, (chunkI + 1) * chunkSize));
+	});
+}
+
+template<typename Gas>
+void GasModel::interactOneMolecule(PhysVal_t& ownEnergy, size_t moleculeI)
+{
+	// Ghosts walk the pairs they have with own molecules. The owner of the ghost walks the same pairs
+	// from the other side, so each of the two keeps half of the energy:
+	PhysVal_t ghostEnergy = 0.0;
+	PhysVal_t& potEnergy = (moleculeI < moleculeCount - ghostCount)? ownEnergy : ghostEnergy;
+
+	if (moleculeLayout == STRUCT_OF_ARRAYS)
+	{
+		interactOneMoleculeArrays<Gas>(potEnergy, moleculeI);
+	}
+	else if (neighborSearch == VERLET_LIST_SEARCH)
+	{
+		interactOneMoleculeVerletList<Gas>(potEnergy, moleculeI);
+	}
+	else if (neighborSearch == CELL_LIST_SEARCH)
+	{
+		interactOneMoleculeCellList<Gas>(potEnergy, moleculeI);
+	}
+	else
+	{
+		interactOneMoleculeBarnesHut<Gas>(potEnergy, moleculeI);
+	}
+
+	ownEnergy += ghostEnergy / 2;
+}
+
+// Bricks of one colour are processed concurrently, molecules inside a brick - in index order
+template<typename Gas>
+void GasModel::interactWithEachOtherParallel(PhysVal_t& potEnergySum)
+{
+	for (size_t color = 0; color < BRICK_COLORS; ++color)
+	{
+		size_t firstI = brickColorStarts[color];
+
+		threadPool->parallelFor(brickColorStarts[color + 1] - firstI, [this, firstI](size_t taskI, size_t)
+		{
+			size_t brickI = bricksByColor[firstI + taskI];
+
+			PhysVal_t potEnergy = 0.0;
+			for (size_t i = brickStarts[brickI]; i < brickStarts[brickI + 1]; ++i)
+				interactOneMolecule<Gas>(potEnergy, brickMolecules[i]);
+
+			brickPotentialEnergy[brickI] = potEnergy;
+		});
+	}
+
+	// Summing in brick order keeps the result independent of thread scheduling:
+	for (size_t brickI = 0; brickI < brickCount; ++brickI)
+		potEnergySum += brickPotentialEnergy[brickI];
+}
+
+template<typename Gas>
+void GasModel::interactionPass(PhysVal_t& potEnergySum)
+{
+	if (threadPool->size() > 1 && brickCount > 1) interactWithEachOtherParallel<Gas>(potEnergySum);
+	else
+	{
+		for (size_t i = 0; i < moleculeCount; ++i)
+			interactOneMolecule<Gas>(potEnergySum, i);
+	}
+}
+
+template<typename Gas>
+void GasModel::interactWithEachOther()
+{
+	// Energy fix-up hot-fix:
+	currPotentialEnergy = 0.0;
+
+	// Nothing to search for:
+	if constexpr (!Gas::COLLIDES && !Gas::ATTRACTS) return;
+
+	if      (neighborSearch == VERLET_LIST_SEARCH) neighborList->update(molecules, moleculeCount, moleculeCount - ghostCount, *threadPool);
+	else if (neighborSearch ==   CELL_LIST_SEARCH) cellList->build(molecules, moleculeCount);
+	else                                           updateOctTree();
+
+	// Long-range forces see the molecules before collisions shift them:
+	if constexpr (Gas::ATTRACTS)
+	{
+		if (longRangeForce != NO_LONG_RANGE_FORCE) interactLongRange();
+	}
+
+	if (moleculeLayout == STRUCT_OF_ARRAYS) loadMoleculeArrays();
+
+	if (threadPool->size() > 1 && brickCount > 1) sortIntoBricks();
+
+	// The outer shell sees the molecules before collisions shift them, its forces are
+	// an impulse for all the steps until the next one. Its potential is kept for those steps.
+	bool multipleTimeSteps = Gas::ATTRACTS && outerShellSteps > 1;
+	if (multipleTimeSteps && (iteration - outerShellStart) % outerShellSteps == 0)
+	{
+		PhysVal_t innerSqr = innerShellRadius * innerShellRadius;
+
+		attractionShell = {innerSqr, POTENTIAL_CUTOFF_MAX_RADIUS_SQUARE, static_cast<PhysVal_t>(outerShellSteps)};
+		outerPotentialEnergy = 0.0;
+		interactionPass<OuterShellGas>(outerPotentialEnergy);
+
+		attractionShell = {-1.0, innerSqr, 1.0};
+	}
+
+	interactionPass<Gas>(currPotentialEnergy);
+	if (multipleTimeSteps) currPotentialEnergy += outerPotentialEnergy;
+
+	if (moleculeLayout == STRUCT_OF_ARRAYS) storeMoleculeArrays();
+}
+
+void GasModel::interactWithEachOther()
+{
+	switch (gasType)
+	{
+		case IDEAL_GAS:     interactWithEachOther<IdealGas>();     break;
+		case BOUNCY_GAS:    interactWithEachOther<BouncyGas>();    break;
+		case POTENTIAL_GAS: interactWithEachOther<PotentialGas>(); break;
+	}
+}
+
+//==============================================
+// INTERACTION CYCLE
+//==============================================
+
+// Ghosts are scaled and moved like their owners, but their energy is left to the owners.
+// Chunks do not depend on the thread count, so neither do the sums.
+template<typename Gas>
+void GasModel::sweepMolecules()
+{
+	size_t chunkCount = std::max<size_t>(1, mortonChunkCount());
+	size_t chunkSize  = (moleculeCount + chunkCount - 1) / chunkCount;
+	size_t ownCount   = moleculeCount - ghostCount;
+	PhysVal_t scale   = pendingSpeedScale;
+
+	// Observers go over each chunk right after it is integrated, while it is still in cache:
+	bool observing = prepareObservers(chunkCount);
+
+	PhysVal_t chunkKinetic[MAX_MORTON_CHUNKS];
+	PhysVal_t chunkGravity[MAX_MORTON_CHUNKS];
+	threadPool->parallelFor(chunkCount, [this, chunkSize, ownCount, scale, observing, &chunkKinetic, &chunkGravity](size_t chunkI, size_t)
+	{
+		PhysVal_t kinetic = 0.0;
+		PhysVal_t gravity = 0.0;
+
+		size_t last = std::min(moleculeCount, (chunkI + 1) * chunkSize);
+		for (size_t i = chunkI * chunkSize; i < last; ++i)
+		{
+			Molecule& mol = molecules[i];
+
+			if (scale != 1.0) mol.speed *= scale;
+
+			mol.integrationStep<Gas>(Gas::ATTRACTS? &forces[i] : nullptr);
+			box.moleculeBounce(mol);
+
+			if (i >= ownCount) continue;
+
+			// Only attracting gases feel gravity:
+			if constexpr (Gas::ATTRACTS) gravity += MASSES[mol.type] * GRAVITY * mol.coords.z;
+
+			kinetic += MASSES[mol.type] * mol.speed.lenSqr();
+		}
+
+		chunkKinetic[chunkI] = kinetic;
+		chunkGravity[chunkI] = gravity;
+
+		if (observing) observeChunk(chunkI, chunkI * chunkSize, last);
+	});
+
+	sweptKineticEnergy = 0.0;
+	sweptGravityEnergy = 0.0;
+	for (size_t chunkI = 0; chunkI < chunkCount; ++chunkI)
+	{
+		sweptKineticEnergy += chunkKinetic[chunkI];
+		sweptGravityEnergy += chunkGravity[chunkI];
+	}
+
+	sweptEnergyValid  = true;
+	pendingSpeedScale = 1.0;
+}
+
+// Molecules are bounced off the walls before the interaction, so the potential is found
+// for the same positions as the swept energies. Molecules that collisions shift out of the box
+// are bounced back right away, so every step ends with all molecules inside.
+template<typename Gas>
+void GasModel::iterationCycle()
+{
+	// Molecules fly straight between events, so a whole step is taken at once:
+	if constexpr (Gas::TYPE == BOUNCY_GAS)
+	{
+		if (collisionEvents)
+		{
+			collisionEvents->advance(molecules, moleculeCount, 1.0);
+			observeMolecules();
+
+			sweptEnergyValid = false;
+			++iteration;
+			finishObservers();
+			return;
+		}
+	}
+
+	sweepMolecules<Gas>();
+
+	interactWithEachOther<Gas>();
+
+	++iteration;
+	finishObservers();
+}
+
+void GasModel::iterationCycle()
+{
+	switch (gasType)
+	{
+		case IDEAL_GAS:     iterationCycle<IdealGas>();     break;
+		case BOUNCY_GAS:    iterationCycle<BouncyGas>();    break;
+		case POTENTIAL_GAS: iterationCycle<PotentialGas>(); break;
+	}
+}
+
+//==============================================
+// OBSERVERS
+//==============================================
+
+void GasModel::addObserver(Observer* observer, size_t every)
+{
+	if (observer == nullptr || every == 0)
+	{
+		printf("GasModel::addObserver(): Expected an observer called at least every so many steps\n");
+		exit(1);
+	}
+
+	observers.push_back({observer, every, 0, false});
+}
+
+void GasModel::removeObserver(Observer* observer)
+{
+	observers.erase(std::remove_if(observers.begin(), observers.end(),
+	                               [observer](const ObserverCadence& cadence) { return cadence.observer == observer; }),
+	                observers.end());
+}
+
+// Sums of the observers due in this step go one after another, a chunk's worth of them at a time
+bool GasModel::prepareObservers(size_t chunkCount)
+{
+	observerSumCount   = 0;
+	observerChunkCount = 0;
+
+	for (ObserverCadence& cadence : observers)
+	{
+		cadence.due = iteration % cadence.every == 0;
+		if (!cadence.due) continue;
+
+		cadence.firstSum  = observerSumCount;
+		observerSumCount += cadence.observer->sumCount();
+		observerChunkCount = chunkCount;
+	}
+
+	if (observerChunkCount == 0) return false;
+
+	observerSums.assign(observerChunkCount * observerSumCount, 0.0);
+	return true;
+}
+
+// Ghosts are left to the models that own them
+void GasModel::observeChunk(size_t chunkI, size_t first, size_t last)
+{
+	last = std::min(last, moleculeCount - ghostCount);
+	if (first >= last) return;
+
+	PhysVal_t* sums = observerSums.data() + chunkI * observerSumCount;
+	for (const ObserverCadence& cadence : observers)
+	{
+		if (cadence.due) cadence.observer->reduce(molecules + first, last - first, sums + cadence.firstSum);
+	}
+}
+
+// Pass of its own for steps that make no sweep
+void GasModel::observeMolecules()
+{
+	size_t chunkCount = std::max<size_t>(1, mortonChunkCount());
+	size_t chunkSize  = (moleculeCount + chunkCount - 1) / chunkCount;
+
+	if (!prepareObservers(chunkCount)) return;
+
+	threadPool->parallelFor(chunkCount, [this, chunkSize](size_t chunkI, size_t)
+	{
+		observeChunk(chunkI, chunkI * chunkSize, std::min(moleculeCount, (chunkI + 1) * chunkSize));
+	});
+}
+
+// Chunks are summed in order, so observers get the same sums on any number of threads
+void GasModel::finishObservers()
+{
+	if (observerChunkCount == 0) return;
+
+	for (size_t chunkI = 1; chunkI < observerChunkCount; ++chunkI)
+	{
+		for (size_t sumI = 0; sumI < observerSumCount; ++sumI)
+			observerSums[sumI] += observerSums[chunkI * observerSumCount + sumI];
+	}
+
+	for (ObserverCadence& cadence : observers)
+	{
+		if (!cadence.due) continue;
+
+		cadence.observer->observe(*this, observerSums.data() + cadence.firstSum);
+		cadence.due = false;
+	}
+
+	observerChunkCount = 0;
+}
+
+//==============================================
+// ENERGY LOSS FIX-UP
+//==============================================
+
+// Energies of the molecules the model owns, ghosts are left to their owners.
+// Speeds count with the fix-up factor the next sweep is yet to apply.
+void GasModel::measureEnergy(PhysVal_t& kineticEnergy, PhysVal_t& potentialEnergy) const
+{
+	kineticEnergy   = 0.0;
+	potentialEnergy = currPotentialEnergy;
+
+	for (size_t i = 0; i < moleculeCount - ghostCount; ++i)
+	{
+		// Only attracting gases feel gravity:
+		if (gasType == POTENTIAL_GAS)
+			potentialEnergy += MASSES[molecules[i].type] * GRAVITY * molecules[i].coords.z;
+
+		kineticEnergy += MASSES[molecules[i].type] * molecules[i].speed.lenSqr();
+	}
+
+	kineticEnergy *= pendingSpeedScale * pendingSpeedScale;
+}
+
+// Sums of the last sweep save a pass over the molecules, unless the molecules changed since
+void GasModel::lastStepEnergy(PhysVal_t& kineticEnergy, PhysVal_t& potentialEnergy) const
+{
+	if (!sweptEnergyValid)
+	{
+		measureEnergy(kineticEnergy, potentialEnergy);
+		return;
+	}
+
+	kineticEnergy   = sweptKineticEnergy;
+	potentialEnergy = currPotentialEnergy + sweptGravityEnergy;
+}
+
+void GasModel::scaleSpeeds(PhysVal_t factor)
+{
+	// Predicted events have to keep up with the speeds:
+	if (collisionEvents)
+	{
+		collisionEvents->scaleSpeeds(molecules, moleculeCount, factor);
+		return;
+	}
+
+	// Left to the next sweep, ghosts of the next step get it too:
+	pendingSpeedScale  *= factor;
+	sweptKineticEnergy *= factor * factor;
+}
+
+void GasModel::fixEnergy()
+{
+	// Calculate Fix-Up factor:
+	PhysVal_t currKineticEnergy;
+	lastStepEnergy(currKineticEnergy, currPotentialEnergy);
+
+	if (prevTotalEnergyCalculated)
+		scaleSpeeds(std::sqrt((prevTotalEnergy - currPotentialEnergy)/currKineticEnergy));
+
+	prevTotalEnergy = currKineticEnergy + currPotentialEnergy;
+	currPotentialEnergy = 0.0;
+
+	prevTotalEnergyCalculated = true;
+}
+
+//==============================================
+// CHECKPOINTS
+//==============================================
+
+// The next step starts over with whatever a restored model would have
+void GasModel::invalidateForCheckpoint()
+{
+	neighborList->invalidate();
+	invalidateOctTree();
+	invalidateEvents();
+}
+
+// Written aside in a single call and renamed over the old checkpoint, so a crash midway leaves the old one whole
+void GasModel::saveCheckpoint(const char* path, const std::mt19937* generator)
+{
+	if (ghostCount != 0)
+	{
+		printf("GasModel::saveCheckpoint(): Ghosts belong to other models, save between steps\n");
+		exit(1);
+	}
+
+	std::string generatorState;
+	if (generator)
+	{
+		std::ostringstream text;
+		text << *generator;
+		generatorState = text.str();
+	}
+
+	CheckpointHeader header = {};
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	header.version        = CHECKPOINT_VERSION;
+	header.gasType        = gasType;
+	header.moleculeBytes  = sizeof(Molecule);
+	header.vectorBytes    = sizeof(Vector);
+	header.moleculeCount  = moleculeCount;
+	header.forceCount     = forces? moleculeCount : 0;
+	header.generatorBytes = generatorState.size();
+
+	header.boxSize[0] = box.containerSize.x;
+	header.boxSize[1] = box.containerSize.y;
+	header.boxSize[2] = box.containerSize.z;
+	for (size_t axis = 0; axis < 3; ++axis)
+		header.boundaries[axis] = box.getBoundary(axis);
+
+	header.outerShellSteps      = outerShellSteps;
+	header.outerShellStart      = outerShellStart;
+	header.innerShellRadius     = innerShellRadius;
+	header.attractionShell      = attractionShell;
+	header.outerPotentialEnergy = outerPotentialEnergy;
+
+	header.prevTotalEnergyCalculated = prevTotalEnergyCalculated;
+	header.sweptEnergyValid          = sweptEnergyValid;
+	header.prevTotalEnergy           = prevTotalEnergy;
+	header.currPotentialEnergy       = currPotentialEnergy;
+	header.sweptKineticEnergy        = sweptKineticEnergy;
+	header.sweptGravityEnergy        = sweptGravityEnergy;
+	header.pendingSpeedScale         = pendingSpeedScale;
+
+	header.iteration = iteration;
+
+	iovec parts[4] = {
+		{&header,            sizeof(header)},
+		{molecules,          moleculeCount     * sizeof(Molecule)},
+		{forces,             header.forceCount * sizeof(Vector)},
+		{&generatorState[0], generatorState.size()}
+	};
+
+	size_t totalBytes = 0;
+	for (const iovec& part : parts)
+		totalBytes += part.iov_len;
+
+	std::string written = std::string(path) + ".tmp";
+
+	int fd = open(written.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+	{
+		printf("GasModel::saveCheckpoint(): Unable to open file \'%s\'\n", written.c_str());
+		exit(1);
+	}
+
+	if (writev(fd, parts, 4) != static_cast<ssize_t>(totalBytes) || fsync(fd) == -1 || close(fd) == -1 ||
+	    rename(written.c_str(), path) == -1)
+	{
+		printf("GasModel::saveCheckpoint(): Unable to save checkpoint \'%s\'\n", path);
+		exit(1);
+	}
+
+	invalidateForCheckpoint();
+}
+
+void GasModel::loadCheckpoint(const char* path, std::mt19937* generator)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+	{
+		printf("GasModel::loadCheckpoint(): Unable to open file \'%s\'\n", path);
+		exit(1);
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) == -1 || static_cast<size_t>(fileStat.st_size) < sizeof(CheckpointHeader))
+	{
+		printf("GasModel::loadCheckpoint(): File \'%s\' is too short for a checkpoint\n", path);
+		exit(1);
+	}
+
+	size_t fileBytes = fileStat.st_size;
+
+	void* mapping = mmap(nullptr, fileBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED)
+	{
+		printf("GasModel::loadCheckpoint(): Unable to map file \'%s\'\n", path);
+		exit(1);
+	}
+
+	const char* image = static_cast<const char*>(mapping);
+
+	CheckpointHeader header;
+	memcpy(&header, image, sizeof(header));
+
+	// Counts are checked against the file before they are multiplied, so that the sizes do not wrap:
+	bool countsFit = header.moleculeCount  <= fileBytes / sizeof(Molecule) &&
+	                 header.forceCount     <= fileBytes / sizeof(Vector)   &&
+	                 header.generatorBytes <= fileBytes;
+
+	size_t moleculesBytes = countsFit? header.moleculeCount * sizeof(Molecule) : 0;
+	size_t forcesBytes    = countsFit? header.forceCount    * sizeof(Vector)   : 0;
+
+	if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 || header.version != CHECKPOINT_VERSION ||
+	    header.moleculeBytes != sizeof(Molecule) || header.vectorBytes != sizeof(Vector) || !countsFit ||
+	    fileBytes != sizeof(header) + moleculesBytes + forcesBytes + header.generatorBytes)
+	{
+		printf("GasModel::loadCheckpoint(): File \'%s\' is not a version %u checkpoint of this build\n", path,
+		       CHECKPOINT_VERSION);
+		exit(1);
+	}
+
+	if (header.gasType != gasType || header.forceCount != (forces? header.moleculeCount : 0) ||
+	    header.boxSize[0] != box.containerSize.x || header.boxSize[1] != box.containerSize.y ||
+	    header.boxSize[2] != box.containerSize.z)
+	{
+		printf("GasModel::loadCheckpoint(): Checkpoint \'%s\' is of another gas or box\n", path);
+		exit(1);
+	}
+
+	if (generator && header.generatorBytes == 0)
+	{
+		printf("GasModel::loadCheckpoint(): Checkpoint \'%s\' has no generator state\n", path);
+		exit(1);
+	}
+
+	setBoundaries(static_cast<Boundary>(header.boundaries[0]), static_cast<Boundary>(header.boundaries[1]),
+	              static_cast<Boundary>(header.boundaries[2]));
+	setMultipleTimeSteps(header.outerShellSteps, header.innerShellRadius);
+
+	moleculeCount = 0;
+	ghostCount    = 0;
+	reserveMolecules(header.moleculeCount);
+
+	memcpy(molecules, image + sizeof(header), moleculesBytes);
+	if (forces) memcpy(forces, image + sizeof(header) + moleculesBytes, forcesBytes);
+	moleculeCount = header.moleculeCount;
+
+	outerShellStart      = header.outerShellStart;
+	attractionShell      = header.attractionShell;
+	outerPotentialEnergy = header.outerPotentialEnergy;
+
+	prevTotalEnergyCalculated = header.prevTotalEnergyCalculated;
+	sweptEnergyValid          = header.sweptEnergyValid;
+	prevTotalEnergy           = header.prevTotalEnergy;
+	currPotentialEnergy       = header.currPotentialEnergy;
+	sweptKineticEnergy        = header.sweptKineticEnergy;
+	sweptGravityEnergy        = header.sweptGravityEnergy;
+	pendingSpeedScale         = header.pendingSpeedScale;
+
+	iteration = header.iteration;
+
+	if (generator)
+	{
+		std::istringstream text(std::string(image + fileBytes - header.generatorBytes, header.generatorBytes));
+		text >> *generator;
+	}
+
+	munmap(mapping, fileBytes);
+	close(fd);
+
+	invalidateForCheckpoint();
 }
@@ -3,86 +3,380 @@
 #define GAS_MODEL_MODEL_HPP_INCLUDED
 
 #include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
 
 //==============================================
 // SIMULATION PROPERTIES                        
 //==============================================
 
-// Gas Types:
-// IDEAL
-// BOUNCY
-// POTENTIAL
-#define POTENTIAL
-
-const size_t MAX_NUMBER_OF_MOLECULES = 50000;
+// Molecules the model has room for before the first reallocation
+const size_t DEFAULT_MOLECULE_CAPACITY = 50000;
 
 using PhysVal_t = double;
 const PhysVal_t GRAVITY = 0.00005;
 
 //==============================================
 
+#include "GasTypes.hpp"
 #include "Vector.hpp"
 #include "Molecule.hpp"
 #include "MoleculeTypes.hpp"
 #include "Walls.hpp"
+#include "Threading.hpp"
+#include "CellList.hpp"
+#include "CollisionEvents.hpp"
+#include "NeighborList.hpp"
+#include "MoleculeArrays.hpp"
+#include "LennardJonesTable.hpp"
+#include "Multipole.hpp"
+#include "Observers.hpp"
 
-// Barnes-Hut Oct-Tree
-struct OctTreeNode
+// Barnes-Hut Oct-Tree node. At 32 bytes two of them share a cache line and none straddles one.
+// Children are stored one after another from firstChild, in the order of their octants.
+// Parents are kept in a separate array, the traversal never looks up.
+struct alignas(32) OctTreeNode
 {
-	int octs[8];
-	int prev;
+	int firstChild;
 	int molecule;
 	int count;
-	Vector center;
+	uint8_t childMask;
+	uint8_t octant;
+	uint8_t depth;
+
+	// The fourth lane is zero, so that the center loads into a register in one go
+	float center[4];
 
 	OctTreeNode() = default;
 
-	void initNode(int moleculeI, int prevI, unsigned newCount, Vector newCenter);
+	void initNode(int moleculeI, unsigned newCount, Vector newCenter, unsigned newDepth, unsigned newOctant);
+
+	inline Vector getCenter() const;
+	inline unsigned childCount() const;
+	inline unsigned childRank(unsigned oct) const;
+};
+
+static_assert(sizeof(OctTreeNode) == 32, "OctTreeNode: Should take half a cache line");
+
+// How the tree follows the molecules from one step to the next.
+// A refit moves only the molecules that left their leaf and gives the same tree a rebuild would.
+enum OctTreeUpdate
+{
+	REBUILD_OCT_TREE = 0,
+	REFIT_OCT_TREE   = 1
+};
+
+// Ways to find interaction partners
+enum NeighborSearch
+{
+	OCT_TREE_SEARCH    = 0,
+	CELL_LIST_SEARCH   = 1,
+	VERLET_LIST_SEARCH = 2
+};
+
+// How molecules are laid out for the interaction pass
+enum MoleculeLayout
+{
+	ARRAY_OF_STRUCTS = 0,
+	STRUCT_OF_ARRAYS = 1
+};
+
+// How bouncy gases move: step by step with overlaps resolved after the fact,
+// or from one predicted collision to the next
+enum BouncyIntegration
+{
+	TIME_STEPPED = 0,
+	EVENT_DRIVEN = 1
+};
+
+// Precision of the array kernels. Mixed one keeps only float coordinates packed with the types and sums forces
+// and energy in double, the molecules themselves always stay in double.
+enum Precision
+{
+	DOUBLE_PRECISION = 0,
+	MIXED_PRECISION  = 1
+};
+
+// Steps the precision drift report runs both precisions for
+const size_t DEFAULT_PRECISION_DRIFT_STEPS = 200;
+
+// How Lennard-Jones forces and potentials are computed
+enum PotentialEvaluation
+{
+	ANALYTIC_POTENTIAL  = 0,
+	TABULATED_POTENTIAL = 1
+};
+
+// Forces summed over the whole box with Barnes-Hut multipoles, on top of Lennard-Jones
+enum LongRangeForce
+{
+	NO_LONG_RANGE_FORCE = 0,
+	SELF_GRAVITY        = 1,
+	COULOMB_FORCE       = 2
 };
 
+// Lennard-Jones pairs closer than this are evaluated every step with multiple time stepping
+const PhysVal_t DEFAULT_INNER_SHELL_RADIUS = 3.5 * MAXIMUM_COLLISION_RADIUS;
+
+// Molecules the long-range error report compares against the naive sum
+const size_t DEFAULT_LONG_RANGE_ERROR_SAMPLES = 1000;
+
 // Gas Model class
 class GasModel 
 {
 public:
 	// Ctor && dtor:
-	GasModel(Vector boxSize);
+	GasModel(Vector boxSize, size_t threads = 1, GasType gas = POTENTIAL_GAS,
+	         size_t capacity = DEFAULT_MOLECULE_CAPACITY);
 	~GasModel();
 
-	// System properties
+	// System properties, capacity grows on demand:
 	void addMolecule(Molecule mol);
+	void removeMolecule(size_t moleculeI);
+	void reserveMolecules(size_t capacity);
+
+	// Walls or wraparound along every axis, periodic axes have to span two interaction ranges.
+	// Partners are seen at their nearest periodic images:
+	void setBoundaries(Boundary boundaryX, Boundary boundaryY, Boundary boundaryZ);
+
+	// Ghosts are copies of molecules owned by another model, they go after the own molecules.
+	// Refreshing a ghost in place keeps neighbor lists and the tree, adding and removing them does not:
+	void addGhostMolecule(Molecule mol, Vector force);
+	void refreshGhostMolecule(size_t ghostI, Molecule mol, Vector force);
+	void removeGhostMolecules();
+
+	// Multithreading:
+	void setThreadCount(size_t threads);
+	size_t getThreadCount() const;
+
+	// Neighbor search:
+	void setNeighborSearch(NeighborSearch search);
+	void setVerletSkin(PhysVal_t skin);
+	void setOctTreeUpdate(OctTreeUpdate update);
+	void invalidateOctTree();
+
+	// Bouncy gases only. Molecules changed from outside between steps need invalidateEvents():
+	void setBouncyIntegration(BouncyIntegration integration);
+	void invalidateEvents();
+
+	// Interaction layout, precision only matters for the structure of arrays:
+	void setMoleculeLayout(MoleculeLayout layout);
+	void setPrecision(Precision newPrecision);
+
+	// Runs copies of the model in both precisions without the energy fix-up,
+	// prints the energy drift of each and returns the one of the mixed precision
+	PhysVal_t reportPrecisionDrift(size_t steps = DEFAULT_PRECISION_DRIFT_STEPS);
+
+	// Lennard-Jones evaluation, tables are more accurate with more intervals:
+	void setPotentialEvaluation(PotentialEvaluation evaluation,
+	                            size_t tableIntervals = DEFAULT_LENNARD_JONES_TABLE_INTERVALS);
+
+	// Long-range forces, attracting gases only. Larger opening angles are faster and less accurate:
+	void setLongRangeForce(LongRangeForce force, PhysVal_t angle = DEFAULT_OPENING_ANGLE,
+	                       MultipoleOrder order = QUADRUPOLE_ORDER);
+
+	// Multiple time stepping, attracting gases only: Lennard-Jones pairs beyond the inner radius
+	// are evaluated every outerSteps steps with their forces scaled up to match. One step turns it off:
+	void setMultipleTimeSteps(size_t outerSteps, PhysVal_t innerRadius = DEFAULT_INNER_SHELL_RADIUS);
+
+	// Prints the worst and mean errors of the multipole sum against the naive one, returns the worst
+	PhysVal_t reportLongRangeError(size_t samples = DEFAULT_LONG_RANGE_ERROR_SAMPLES);
+
+	// Checkpoints hold the molecules, the box, the energy fix-up and the caller's generator, if given.
+	// The rest of the setup is left to the caller. Both calls make the model rebuild its lists and
+	// predicted events, so the saved model and the restored one go on bit for bit the same,
+	// as long as they are set up alike and both run on one thread or both on several:
+	void saveCheckpoint(const char* path, const std::mt19937* generator = nullptr);
+	void loadCheckpoint(const char* path, std::mt19937* generator = nullptr);
+
+	// Observers are called within every step that starts at a multiple of their cadence.
+	// The model does not own them, they have to be removed before they are gone:
+	void addObserver(Observer* observer, size_t every = 1);
+	void removeObserver(Observer* observer);
 
 	// Oct-Tree Stuff
 	char calculateOct(size_t moleculeI, int curI) const;
-	void insertNode(int moleculeI, int prevI, unsigned newCount, unsigned depth, char oct);
+	size_t mortonChunkCount() const;
+	void computeMortonKeys();
+	void sortMortonKeys();
+	unsigned mortonCommonDepth(size_t sortedI) const;
+	size_t equalKeysEnd(size_t sortedI, size_t last) const;
+	size_t countOctantNodes(size_t first, size_t last, size_t& degenerateLeaves) const;
+	void buildOctant(size_t first, size_t last, int nodeI);
+	void packOctTree();
+	void buildOctTreeNodes();
 	void buildOctTree();
+	// Keeps the first liveNodes nodes of the current tree and parents:
+	void reserveOctTree(size_t nodes, size_t liveNodes);
+
+	// Incremental Oct-Tree refit:
+	Vector octTreeCellCenter(uint64_t key, unsigned depth) const;
+	int moveOctTreeChildren(int nodeI, unsigned newMask);
+	void removeFromOctTree(size_t moleculeI);
+	void insertIntoOctTree(size_t moleculeI);
+	bool refitOctTree();
+	void updateOctTree();
 
-	// Collision:
-	void collideOneMoleculeBarnesHut(int moleculeI, int curI, unsigned depth);
-	void attractOneMoleculeBarnesHut(int moleculeI, int curI, unsigned depth);
-	void interactWithEachOtherNaive();
+	// Barnes-Hut multipoles:
+	PhysVal_t longRangeStrength(size_t moleculeI) const;
+	void computeMultipole(int nodeI);
+	void buildMultipoles();
+	void longRangeFieldBarnesHut(size_t moleculeI, Vector& field, PhysVal_t& potential) const;
+	void longRangeFieldNaive(size_t moleculeI, Vector& field, PhysVal_t& potential) const;
+	void interactLongRange();
+
+	// Collision, instantiated once per gas type:
+	template<typename Func> void forEachTreeNeighbor(int moleculeI, Func func);
+	inline bool isGhost(size_t moleculeI) const;
+	template<typename Gas> void interactOneMoleculeBarnesHut(PhysVal_t& potEnergy, size_t moleculeI);
+	template<typename Gas> void interactOneMoleculeCellList(PhysVal_t& potEnergy, size_t moleculeI);
+	inline size_t verletPartnersEnd(size_t moleculeI) const;
+	template<typename Gas> void interactOneMoleculeVerletList(PhysVal_t& potEnergy, size_t moleculeI);
+	template<typename Gas> void interactOneMoleculeArrays(PhysVal_t& potEnergy, size_t moleculeI);
+	void loadMoleculeArrays();
+	void storeMoleculeArrays();
+	template<typename Gas> void interactOneMolecule(PhysVal_t& ownEnergy, size_t moleculeI);
+	template<typename Gas> void interactWithEachOtherParallel(PhysVal_t& potEnergySum);
+	template<typename Gas> void interactionPass(PhysVal_t& potEnergySum);
+	template<typename Gas> void interactWithEachOther();
 	void interactWithEachOther();
 
-	// General simulation cycle:
+	// Parallel interaction bricks:
+	void layoutBricks();
+	void sortIntoBricks();
+
+	// Single pass over the molecules that integrates, bounces and sums their energy:
+	template<typename Gas> void sweepMolecules();
+
+	// Observer sums, reduced chunk by chunk by the sweep or by a pass of their own:
+	bool prepareObservers(size_t chunkCount);
+	void observeChunk(size_t chunkI, size_t first, size_t last);
+	void observeMolecules();
+	void finishObservers();
+
+	// General simulation cycle, dispatched on the gas type once per step:
+	template<typename Gas> void iterationCycle();
 	void iterationCycle();
 
+	void invalidateForCheckpoint();
+
 	// Box:
 	GasContainer box;
 
+	// Physics, fixed at construction:
+	GasType gasType;
+	PhysVal_t interactionRange;
+
 	// Molecules:
 	Molecule* molecules;
 	size_t moleculeCount;
+	size_t moleculeCapacity;
+	size_t ghostCount;
+
+	// Forces for the next integration step, nullptr for gases without attraction:
+	Vector* forces;
+
+	// Neighbor search stuff:
+	NeighborSearch neighborSearch;
+	CellList* cellList;
+	NeighborList* neighborList;
+
+	// Structure-of-arrays copy for the vectorized kernels:
+	MoleculeLayout moleculeLayout;
+	Precision precision;
+	MoleculeArrays* moleculeArrays;
+
+	// Event-driven engine, nullptr when stepping in time:
+	CollisionEvents* collisionEvents;
+
+	// Spline tables, nullptr for the analytic form:
+	LennardJonesTable* lennardJonesTable;
 
 	// Oct-Tree stuff:
 	OctTreeNode* octTree;
+	int* octTreeParents;
 	size_t octTreeSize;
-	bool octTreeFuckedUp;
+	size_t octTreeCapacity;
 	Vector* sizeAtDepth;
 
+	// Molecules no tree level can tell apart share a leaf, chained from its molecule on.
+	// Counters of such leaves in the current tree and of the tree updates that had any:
+	int* octTreeNext;
+	size_t octTreeDegenerateLeaves;
+	size_t octTreeDegenerateUpdates;
+
+	// Molecules sorted along the Z-order curve the tree is built from:
+	uint64_t* mortonKeys;
+	int* mortonOrder;
+	uint64_t* mortonKeysScratch;
+	int* mortonOrderScratch;
+	size_t* radixHistograms;
+
+	// The tree in the order it is built in, before siblings are packed together:
+	OctTreeNode* octTreeBuild;
+	int* octTreeBuildParents;
+	int* octTreeChildStarts;
+
+	// Refit state, the leaf and Morton key every molecule has in the current tree:
+	OctTreeUpdate octTreeUpdate;
+	bool octTreeRefittable;
+	size_t octTreeMoleculeCount;
+	size_t octTreeGarbage;
+	int* octTreeLeaves;
+	uint64_t* octTreeKeys;
+
+	// Long-range forces and the multipoles of the tree nodes:
+	LongRangeForce longRangeForce;
+	PhysVal_t longRangeCoupling;
+	PhysVal_t openingAngle;
+	MultipoleOrder multipoleOrder;
+	Multipole* octTreeMultipoles;
+
+	// Steps made so far:
+	size_t iteration;
+
+	// Multiple time stepping, the shell of pairs the current pass takes and the potential of the outer one:
+	size_t outerShellSteps;
+	size_t outerShellStart;
+	PhysVal_t innerShellRadius;
+	AttractionShell attractionShell;
+	PhysVal_t outerPotentialEnergy;
+
+	// Threads and the brick grid they split the molecules by:
+	ThreadPool* threadPool;
+	size_t brickCounts[3];
+	size_t brickCount;
+	Vector brickSize;
+	size_t brickColorStarts[9];
+	size_t* bricksByColor;
+	size_t* brickStarts;
+	size_t* brickMolecules;
+	PhysVal_t* brickPotentialEnergy;
+
 	// Energy Loss Fix-Up Hot-Fix:
 	PhysVal_t prevTotalEnergy;
 	PhysVal_t currPotentialEnergy;
 	bool prevTotalEnergyCalculated;
+	void measureEnergy(PhysVal_t& kineticEnergy, PhysVal_t& potentialEnergy) const;
+	void lastStepEnergy(PhysVal_t& kineticEnergy, PhysVal_t& potentialEnergy) const;
+	void scaleSpeeds(PhysVal_t factor);
 	void fixEnergy();
+
+	// Energies of own molecules summed by the last sweep, until molecules are added or removed.
+	// Collisions and the bounces after them come later in the step, fix-ups see them a step late:
+	PhysVal_t sweptKineticEnergy;
+	PhysVal_t sweptGravityEnergy;
+	bool sweptEnergyValid;
+
+	// Fix-up factor the next sweep applies to the speeds before integrating:
+	PhysVal_t pendingSpeedScale;
+
+	// Observers and the sums of every chunk for the ones due in the current step:
+	std::vector<ObserverCadence> observers;
+	std::vector<PhysVal_t> observerSums;
+	size_t observerSumCount;
+	size_t observerChunkCount;
 };
 
 #endif  // GAS_MODEL_MODEL_HPP_INCLUDED
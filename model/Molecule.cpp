@@ -1,96 +1,121 @@
 // No Copyright. Vladislav Aleinik 2019
 #include "Molecule.hpp"
+#include "Walls.hpp"
 
-Molecule::Molecule(Vector newCoords, Vector newSpeed, MoleculeType newType) :  
+#include <limits>
+
+Molecule::Molecule(Vector newCoords, Vector newSpeed, MoleculeType newType) :
 	coords (newCoords),
 	speed  (newSpeed),
-	force  ({0, 0, 0}),
 	type   (newType)
 {}
 
-inline void Molecule::integrationStep()
+template<typename Gas>
+inline void Molecule::integrationStep(Vector* force)
 {
-#if defined(IDEAL) || defined(BOUNCY)
-
-	coords += speed;
-
-#elif defined(POTENTIAL)
+	if constexpr (!Gas::ATTRACTS)
+	{
+		coords += speed;
+	}
+	else
+	{
+		coords += speed + *force / (2 * MASSES[type]);
+		speed += *force/MASSES[type];
+		*force = {0, 0, -GRAVITY*MASSES[type]};
+	}
+}
 
-	coords += speed + force / (2 * MASSES[type]);
-	speed += force/MASSES[type];
-	force = {0, 0, -GRAVITY*MASSES[type]};
+inline bool visitsPair(size_t moleculeI, size_t partnerI, size_t ownCount)
+{
+	return partnerI < ownCount && (moleculeI < partnerI || ownCount <= moleculeI);
+}
 
-#else
-	static_assert(false, "integrationStep: Unknown gas type: GAS_TYPE should be IDEAL, BOUNCY or POTENTIAL\n");
-#endif
+inline PhysVal_t imageShift(PhysVal_t diff, PhysVal_t period)
+{
+	return (diff > 0.5 * period)? -period : (diff < -0.5 * period)? period : 0.0;
 }
 
-void moleculesCollide(Molecule& molA, Molecule& molB)
+inline Vector imageShift(const Vector& diff, const Vector& period)
 {
-#if defined(IDEAL)
+	return Vector(imageShift(diff.x, period.x), imageShift(diff.y, period.y), imageShift(diff.z, period.z));
+}
 
-	return;
+inline Vector nearestImage(const Vector& diff, const Vector& period)
+{
+	return diff + imageShift(diff, period);
+}
 
-#elif defined(BOUNCY)
+template<typename Gas>
+void moleculesCollide(Molecule& molA, Molecule& molB, const GasContainer& box, bool splitShift)
+{
+	if constexpr (!Gas::COLLIDES) return;
 
 	Vector coordDiff = molA.coords - molB.coords;
 
-	if (coordDiff.lenSqr() > MAXIMUM_COLLISION_RADIUS_SQUAREx4) return;
-
-	// Shift out of collision:
-	PhysVal_t radiusSum = COLLISION_RADIUS[molA.type] + COLLISION_RADIUS[molB.type];
-	coordDiff.setLength(radiusSum);
-	molA.coords = molB.coords + coordDiff;
-
-	Vector speedDiffProj = 
-		coordDiff * (coordDiff.scalar(molA.speed - molB.speed) / (radiusSum * radiusSum));
-
-	molA.speed -= speedDiffProj;
-	molB.speed += speedDiffProj;
-	
-#elif defined(POTENTIAL)
-
-	Vector coordDiff = molA.coords - molB.coords; 
+	// B is moved next to A for the collision and back after it:
+	Vector shift = imageShift(coordDiff, box.period);
+	coordDiff += shift;
 
 	if (coordDiff.lenSqr() > MAXIMUM_COLLISION_RADIUS_SQUAREx4) return;
 
-	// Shift out of collision:
+	// Shift out of collision, coincident molecules have no direction to be shifted along:
 	PhysVal_t radiusSum = COLLISION_RADIUS[molA.type] + COLLISION_RADIUS[molB.type];
-	coordDiff.setLength(radiusSum);
-	molA.coords = (molA.coords + molB.coords + coordDiff)/2;
-	molB.coords = molA.coords - coordDiff;
 
-	Vector speedDiffProj = 
+	PhysVal_t curLen = coordDiff.length();
+	if (curLen >= 10 * std::numeric_limits<PhysVal_t>::epsilon()) coordDiff *= radiusSum / curLen;
+
+	bool shiftsB = Gas::TYPE != BOUNCY_GAS || splitShift;
+	if (!shiftsB)
+	{
+		molA.coords = (molB.coords - shift) + coordDiff;
+	}
+	else
+	{
+		molA.coords = (molA.coords + (molB.coords - shift) + coordDiff)/2;
+		molB.coords = (molA.coords - coordDiff) + shift;
+	}
+
+	Vector speedDiffProj =
 		coordDiff * (coordDiff.scalar(molA.speed - molB.speed) / (radiusSum * radiusSum));
 
 	molA.speed -= speedDiffProj;
 	molB.speed += speedDiffProj;
 
-#else
-	static_assert(false, "moleculesCollide: Unknown gas type: GAS_TYPE should be IDEAL, BOUNCY or POTENTIAL\n");
-#endif
+	// Shifts may push molecules next to a wall out of the box:
+	box.moleculeBounce(molA);
+	if (shiftsB) box.moleculeBounce(molB);
 }
 
-void moleculesAttract(PhysVal_t& potEnergy, Molecule& molA, Molecule& molB)
+template<typename Gas>
+void moleculesAttract(PhysVal_t& potEnergy, const Molecule& molA, const Molecule& molB, Vector& forceA, Vector& forceB,
+                      const Vector& period, const AttractionShell& shell, const LennardJonesTable* table)
 {
-#if defined(IDEAL) || defined(BOUNCY) 
+	if constexpr (!Gas::ATTRACTS) return;
 
-	return;
+	Vector coordDiff = nearestImage(molA.coords - molB.coords, period);
+	PhysVal_t lenSqr = coordDiff.lenSqr();
+	if (lenSqr > shell.toSqr || lenSqr <= shell.fromSqr) return;
 
-#elif defined(POTENTIAL)
+	if (table)
+	{
+		PhysVal_t forceOverDist, potential;
+		table->evaluate(molA.type * TYPES_COUNT + molB.type, lenSqr, forceOverDist, potential);
+		forceOverDist *= shell.forceScale;
 
-	Vector coordDiff = molA.coords - molB.coords;
-	if (coordDiff.lenSqr() > POTENTIAL_CUTOFF_MAX_RADIUS_SQUAREx4) return;
+		forceA -= coordDiff * forceOverDist;
+		forceB += coordDiff * forceOverDist;
 
-	Vector force = coordDiff;
-	force.setLength(LennardJonesForce(molA.type, molB.type, coordDiff.length()));
+		potEnergy += potential;
+		return;
+	}
 
-	molA.force -= force;
-	molB.force += force;
+	PhysVal_t distance = std::sqrt(lenSqr);
 
-	potEnergy += LennardJonesPotential(molA.type, molB.type, coordDiff.length());
+	Vector force = coordDiff;
+	force.setLength(LennardJonesForce(molA.type, molB.type, distance) * shell.forceScale);
+
+	forceA -= force;
+	forceB += force;
 
-#else
-	static_assert(false, "moleculesInteract: Unknown gas type: GAS_TYPE should be IDEAL, BOUNCY or POTENTIAL\n");
-#endif
-}
\ No newline at end of file
+	potEnergy += LennardJonesPotential(molA.type, molB.type, distance);
+}
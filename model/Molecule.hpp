@@ -2,26 +2,62 @@
 #ifndef GAS_MODEL_MOLECULE_HPP_INCLUDED
 #define GAS_MODEL_MOLECULE_HPP_INCLUDED
 
+#include "GasTypes.hpp"
 #include "MoleculeTypes.hpp"
+#include "LennardJonesTable.hpp"
 #include "Vector.hpp"
 
+// Pairs a Lennard-Jones pass takes, from fromSqr exclusive to toSqr inclusive in squared distance,
+// and the factor their forces are scaled by
+struct AttractionShell
+{
+	PhysVal_t fromSqr;
+	PhysVal_t toSqr;
+	PhysVal_t forceScale;
+};
+
+const AttractionShell FULL_ATTRACTION_SHELL = {-1.0, POTENTIAL_CUTOFF_MAX_RADIUS_SQUARE, 1.0};
+
+// Walls.hpp needs the molecule itself:
+class GasContainer;
+
+// Forces live next to the molecules in GasModel, so that gases without attraction do not carry them
 struct Molecule
 {
 public:
 	Vector coords;
 	Vector speed;
-	Vector force;
 	MoleculeType type;
 
 	Molecule() = default;
 
 	Molecule(Vector newCoords, Vector newSpeed, MoleculeType newType);
 
-	inline void integrationStep();
+	// Attracting gases consume the force of the last interaction pass and reset it to gravity
+	template<typename Gas>
+	inline void integrationStep(Vector* force);
 };
 
-void moleculesCollide(Molecule& molA, Molecule& molB);
-
-void moleculesAttract(PhysVal_t& potEnergy, Molecule& molA, Molecule& molB);
-
-#endif // GAS_MODEL_MOLECULE_HPP_INCLUDED
\ No newline at end of file
+// Every pair is evaluated once, from one of its molecules. Own molecules take the own molecules
+// after them, ghosts past ownCount take all own molecules and no other ghosts.
+inline bool visitsPair(size_t moleculeI, size_t partnerI, size_t ownCount);
+
+// Shift that takes a coordinate difference to the nearest periodic image, periods are infinite along walls.
+// Differences are assumed to be less than one and a half periods.
+inline Vector imageShift(const Vector& diff, const Vector& period);
+inline Vector nearestImage(const Vector& diff, const Vector& period);
+
+// Partners are seen at their nearest periodic images, shifts out of collision keep each molecule on its side.
+// Bouncy gases shift only A out of B, unless splitShift is set: a ghost A is thrown away,
+// so both molecules take half of the shift, as every other gas does.
+// Shifted molecules are bounced back into the box.
+template<typename Gas>
+void moleculesCollide(Molecule& molA, Molecule& molB, const GasContainer& box, bool splitShift = false);
+
+// Analytic Lennard-Jones unless a table is given
+template<typename Gas>
+void moleculesAttract(PhysVal_t& potEnergy, const Molecule& molA, const Molecule& molB, Vector& forceA, Vector& forceB,
+                      const Vector& period, const AttractionShell& shell = FULL_ATTRACTION_SHELL,
+                      const LennardJonesTable* table = nullptr);
+
+#endif // GAS_MODEL_MOLECULE_HPP_INCLUDED
@@ -0,0 +1,812 @@
+// No Copyright. Vladislav Aleinik 2019
+#include "MoleculeArrays.hpp"
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+//==============================================
+// MoleculeArrays STORAGE
+//==============================================
+
+const size_t CACHE_LINE = 64;
+
+template<typename Elem>
+Elem* allocateAligned(size_t count)
+{
+	size_t bytes = (count * sizeof(Elem) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+	if (bytes == 0) bytes = CACHE_LINE;
+
+	Elem* array = static_cast<Elem*>(std::aligned_alloc(CACHE_LINE, bytes));
+	if (!array)
+	{
+		printf("MoleculeArrays: Unable to allocate memory!\n");
+		exit(1);
+	}
+
+	return array;
+}
+
+MoleculeArrays::MoleculeArrays() :
+	x        (nullptr),
+	y        (nullptr),
+	z        (nullptr),
+	speedX   (nullptr),
+	speedY   (nullptr),
+	speedZ   (nullptr),
+	forceX   (nullptr),
+	forceY   (nullptr),
+	forceZ   (nullptr),
+	type     (nullptr),
+	floatCoords (false),
+	packed   (nullptr),
+	capacity (0)
+{}
+
+MoleculeArrays::~MoleculeArrays()
+{
+	for (PhysVal_t* array : {x, y, z, speedX, speedY, speedZ, forceX, forceY, forceZ})
+		std::free(array);
+
+	std::free(type);
+	std::free(packed);
+}
+
+void MoleculeArrays::setFloatCoords(bool on)
+{
+	if (on == floatCoords) return;
+
+	for (PhysVal_t** array : {&x, &y, &z, &speedX, &speedY, &speedZ, &forceX, &forceY, &forceZ})
+	{
+		std::free(*array);
+		*array = nullptr;
+	}
+
+	std::free(type);
+	std::free(packed);
+	type   = nullptr;
+	packed = nullptr;
+
+	floatCoords = on;
+	capacity    = 0;
+}
+
+void MoleculeArrays::reserve(size_t count)
+{
+	if (count <= capacity) return;
+
+	if (floatCoords)
+	{
+		std::free(packed);
+		packed = allocateAligned<float>(4 * count);
+
+		capacity = count;
+		return;
+	}
+
+	for (PhysVal_t** array : {&x, &y, &z, &speedX, &speedY, &speedZ, &forceX, &forceY, &forceZ})
+	{
+		std::free(*array);
+		*array = allocateAligned<PhysVal_t>(count);
+	}
+
+	std::free(type);
+	type = allocateAligned<int>(count);
+
+	capacity = count;
+}
+
+// The type goes as the bits of an int, so that the kernels reinterpret it instead of converting
+inline void packMolecule(float* packed, const Molecule& mol)
+{
+	int32_t type = mol.type;
+
+	packed[0] = mol.coords.x;
+	packed[1] = mol.coords.y;
+	packed[2] = mol.coords.z;
+	std::memcpy(packed + 3, &type, sizeof(type));
+}
+
+void MoleculeArrays::load(const Molecule* molecules, const Vector* forces, size_t first, size_t last)
+{
+	if (floatCoords)
+	{
+		for (size_t i = first; i < last; ++i)
+			packMolecule(packed + 4 * i, molecules[i]);
+
+		return;
+	}
+
+	for (size_t i = first; i < last; ++i)
+	{
+		x[i] = molecules[i].coords.x;
+		y[i] = molecules[i].coords.y;
+		z[i] = molecules[i].coords.z;
+
+		speedX[i] = molecules[i].speed.x;
+		speedY[i] = molecules[i].speed.y;
+		speedZ[i] = molecules[i].speed.z;
+
+		type[i] = molecules[i].type;
+	}
+
+	if (!forces) return;
+
+	for (size_t i = first; i < last; ++i)
+	{
+		forceX[i] = forces[i].x;
+		forceY[i] = forces[i].y;
+		forceZ[i] = forces[i].z;
+	}
+}
+
+void MoleculeArrays::store(Molecule* molecules, Vector* forces, size_t first, size_t last) const
+{
+	if (floatCoords) return;
+
+	for (size_t i = first; i < last; ++i)
+	{
+		molecules[i].coords = Vector(x[i], y[i], z[i]);
+		molecules[i].speed  = Vector(speedX[i], speedY[i], speedZ[i]);
+	}
+
+	if (!forces) return;
+
+	for (size_t i = first; i < last; ++i)
+		forces[i] = Vector(forceX[i], forceY[i], forceZ[i]);
+}
+
+//==============================================
+// GATHERS
+//==============================================
+
+// Masked gathers with an explicit source, the plain ones trip -Wmaybe-uninitialized
+inline __m256d gatherCoords(const PhysVal_t* array, __m256i indices)
+{
+	return _mm256_mask_i64gather_pd(_mm256_setzero_pd(), array, indices, _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+}
+
+inline __m256d gatherPairTable(const PhysVal_t* table, __m128i pairIndices)
+{
+	return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), table, pairIndices, _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+}
+
+//==============================================
+// PERIODIC IMAGES
+//==============================================
+
+// Lanes beyond half a period go one period back, infinite periods never match
+inline __m256d nearestImage(__m256d diff, __m256d period)
+{
+	__m256d halfPeriod = _mm256_mul_pd(period, _mm256_set1_pd(0.5));
+
+	__m256d above = _mm256_and_pd(_mm256_cmp_pd(diff, halfPeriod, _CMP_GT_OQ), period);
+	__m256d below = _mm256_and_pd(_mm256_cmp_pd(diff, _mm256_sub_pd(_mm256_setzero_pd(), halfPeriod), _CMP_LT_OQ), period);
+
+	return _mm256_add_pd(_mm256_sub_pd(diff, above), below);
+}
+
+inline __m256 nearestImage(__m256 diff, __m256 period)
+{
+	__m256 halfPeriod = _mm256_mul_ps(period, _mm256_set1_ps(0.5f));
+
+	__m256 above = _mm256_and_ps(_mm256_cmp_ps(diff, halfPeriod, _CMP_GT_OQ), period);
+	__m256 below = _mm256_and_ps(_mm256_cmp_ps(diff, _mm256_sub_ps(_mm256_setzero_ps(), halfPeriod), _CMP_LT_OQ), period);
+
+	return _mm256_add_ps(_mm256_sub_ps(diff, above), below);
+}
+
+inline bool isPeriodic(const Vector& period)
+{
+	return std::isfinite(period.x) || std::isfinite(period.y) || std::isfinite(period.z);
+}
+
+inline __m256d gatherLenSqr(const MoleculeArrays& mols, size_t molA, __m256i indices, const Vector& period, bool periodic)
+{
+	__m256d diffX = _mm256_sub_pd(_mm256_set1_pd(mols.x[molA]), gatherCoords(mols.x, indices));
+	__m256d diffY = _mm256_sub_pd(_mm256_set1_pd(mols.y[molA]), gatherCoords(mols.y, indices));
+	__m256d diffZ = _mm256_sub_pd(_mm256_set1_pd(mols.z[molA]), gatherCoords(mols.z, indices));
+
+	if (periodic)
+	{
+		diffX = nearestImage(diffX, _mm256_set1_pd(period.x));
+		diffY = nearestImage(diffY, _mm256_set1_pd(period.y));
+		diffZ = nearestImage(diffZ, _mm256_set1_pd(period.z));
+	}
+
+	return _mm256_fmadd_pd(diffZ, diffZ, _mm256_fmadd_pd(diffY, diffY, _mm256_mul_pd(diffX, diffX)));
+}
+
+//==============================================
+// COLLISIONS
+//==============================================
+
+// Walls of the box are rare, the molecule goes through moleculeBounce and back
+void arraysBounce(MoleculeArrays& mols, size_t mol, const GasContainer& box)
+{
+	Molecule bounced({mols.x[mol], mols.y[mol], mols.z[mol]}, {mols.speedX[mol], mols.speedY[mol], mols.speedZ[mol]},
+	                 static_cast<MoleculeType>(mols.type[mol]));
+	box.moleculeBounce(bounced);
+
+	mols.x[mol] = bounced.coords.x;
+	mols.y[mol] = bounced.coords.y;
+	mols.z[mol] = bounced.coords.z;
+
+	mols.speedX[mol] = bounced.speed.x;
+	mols.speedY[mol] = bounced.speed.y;
+	mols.speedZ[mol] = bounced.speed.z;
+}
+
+// Same arithmetic as moleculesCollide, one coordinate at a time
+template<typename Gas>
+void arraysCollide(MoleculeArrays& mols, size_t molA, size_t molB, const GasContainer& box, bool splitShift)
+{
+	if constexpr (!Gas::COLLIDES) return;
+
+	PhysVal_t diffX = mols.x[molA] - mols.x[molB];
+	PhysVal_t diffY = mols.y[molA] - mols.y[molB];
+	PhysVal_t diffZ = mols.z[molA] - mols.z[molB];
+
+	// B is moved next to A for the collision and back after it:
+	Vector shift = imageShift(Vector(diffX, diffY, diffZ), box.period);
+	diffX += shift.x;
+	diffY += shift.y;
+	diffZ += shift.z;
+
+	PhysVal_t lenSqr = diffX*diffX + diffY*diffY + diffZ*diffZ;
+	if (lenSqr > MAXIMUM_COLLISION_RADIUS_SQUAREx4) return;
+
+	// Shift out of collision, coincident molecules have no direction to be shifted along:
+	PhysVal_t radiusSum = COLLISION_RADIUS[mols.type[molA]] + COLLISION_RADIUS[mols.type[molB]];
+
+	PhysVal_t curLen = std::sqrt(lenSqr);
+	if (curLen >= 10 * std::numeric_limits<PhysVal_t>::epsilon())
+	{
+		PhysVal_t scale = radiusSum / curLen;
+		diffX *= scale;
+		diffY *= scale;
+		diffZ *= scale;
+	}
+
+	bool shiftsB = Gas::TYPE != BOUNCY_GAS || splitShift;
+	if (!shiftsB)
+	{
+		mols.x[molA] = (mols.x[molB] - shift.x) + diffX;
+		mols.y[molA] = (mols.y[molB] - shift.y) + diffY;
+		mols.z[molA] = (mols.z[molB] - shift.z) + diffZ;
+	}
+	else
+	{
+		mols.x[molA] = (mols.x[molA] + (mols.x[molB] - shift.x) + diffX) * 0.5;
+		mols.y[molA] = (mols.y[molA] + (mols.y[molB] - shift.y) + diffY) * 0.5;
+		mols.z[molA] = (mols.z[molA] + (mols.z[molB] - shift.z) + diffZ) * 0.5;
+
+		mols.x[molB] = (mols.x[molA] - diffX) + shift.x;
+		mols.y[molB] = (mols.y[molA] - diffY) + shift.y;
+		mols.z[molB] = (mols.z[molA] - diffZ) + shift.z;
+	}
+
+	PhysVal_t projection = ((mols.speedX[molA] - mols.speedX[molB]) * diffX + 
+	                        (mols.speedY[molA] - mols.speedY[molB]) * diffY + 
+	                        (mols.speedZ[molA] - mols.speedZ[molB]) * diffZ) / (radiusSum * radiusSum);
+
+	mols.speedX[molA] -= diffX * projection;
+	mols.speedY[molA] -= diffY * projection;
+	mols.speedZ[molA] -= diffZ * projection;
+
+	mols.speedX[molB] += diffX * projection;
+	mols.speedY[molB] += diffY * projection;
+	mols.speedZ[molB] += diffZ * projection;
+
+	arraysBounce(mols, molA, box);
+	if (shiftsB) arraysBounce(mols, molB, box);
+}
+
+// Four partners at a time are checked for contact, only blocks with a contact go through arraysCollide
+template<typename Gas>
+void arraysCollideAll(MoleculeArrays& mols, size_t molA, const size_t* partners, size_t partnerCount, const GasContainer& box,
+                      bool splitShift)
+{
+	if constexpr (!Gas::COLLIDES) return;
+
+	const __m256d contactSqr = _mm256_set1_pd(MAXIMUM_COLLISION_RADIUS_SQUAREx4);
+	const bool    periodic   = isPeriodic(box.period);
+
+	size_t partnerI = 0;
+	for (; partnerI + 4 <= partnerCount; partnerI += 4)
+	{
+		__m256i indices = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(partners + partnerI));
+
+		__m256d inContact = _mm256_cmp_pd(gatherLenSqr(mols, molA, indices, box.period, periodic), contactSqr, _CMP_LE_OQ);
+		if (_mm256_testz_pd(inContact, inContact)) continue;
+
+		// A shifts with every collision, so the whole block is redone one by one:
+		for (size_t lane = 0; lane < 4; ++lane)
+			arraysCollide<Gas>(mols, molA, partners[partnerI + lane], box, splitShift);
+	}
+
+	for (; partnerI < partnerCount; ++partnerI)
+		arraysCollide<Gas>(mols, molA, partners[partnerI], box, splitShift);
+}
+
+//==============================================
+// LENNARD-JONES KERNEL
+//==============================================
+
+// F/r and U are polynomials in 1/r^2, so neither roots nor divisions by r are needed
+inline void attractOnePair(PhysVal_t& potEnergy, MoleculeArrays& mols, size_t molA, size_t molB,
+                           const Vector& period, const AttractionShell& shell, const LennardJonesTable* table)
+{
+	Vector diff = nearestImage(Vector(mols.x[molA] - mols.x[molB], mols.y[molA] - mols.y[molB], mols.z[molA] - mols.z[molB]),
+	                           period);
+
+	PhysVal_t diffX = diff.x;
+	PhysVal_t diffY = diff.y;
+	PhysVal_t diffZ = diff.z;
+
+	PhysVal_t lenSqr = diffX*diffX + diffY*diffY + diffZ*diffZ;
+	if (lenSqr > shell.toSqr || lenSqr <= shell.fromSqr) return;
+
+	size_t pairIndex = mols.type[molA] * TYPES_COUNT + mols.type[molB];
+
+	PhysVal_t forceOverDist, potential;
+	if (table)
+	{
+		table->evaluate(pairIndex, lenSqr, forceOverDist, potential);
+	}
+	else
+	{
+		bool tooClose = lenSqr < LENNARD_JONES_CLOSEST_SQR[pairIndex];
+		if (tooClose) lenSqr = LENNARD_JONES_CLOSEST_SQR[pairIndex];
+
+		PhysVal_t power2 = 1 / lenSqr;
+		PhysVal_t power6 = power2*power2*power2;
+
+		forceOverDist = tooClose? 0.0 :
+			(LENNARD_JONES_FORCE_A[pairIndex] * power6 + LENNARD_JONES_FORCE_B[pairIndex]) * power6 * power2;
+		potential = (LENNARD_JONES_POTENTIAL_A[pairIndex] * power6 + LENNARD_JONES_POTENTIAL_B[pairIndex]) * power6;
+	}
+
+	forceOverDist *= shell.forceScale;
+
+	mols.forceX[molA] -= diffX * forceOverDist;
+	mols.forceY[molA] -= diffY * forceOverDist;
+	mols.forceZ[molA] -= diffZ * forceOverDist;
+
+	mols.forceX[molB] += diffX * forceOverDist;
+	mols.forceY[molB] += diffY * forceOverDist;
+	mols.forceZ[molB] += diffZ * forceOverDist;
+
+	potEnergy += potential;
+}
+
+inline PhysVal_t horizontalSum(__m256d reg)
+{
+	__m128d half = _mm_add_pd(_mm256_castpd256_pd128(reg), _mm256_extractf128_pd(reg, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+}
+
+// Four spline lookups; every lane reads one cache line of coefficients
+inline void tableLookup(const LennardJonesTable& table, __m256d lenSqr, __m128i pairIndices,
+                        __m256d& forceOverDist, __m256d& energy)
+{
+	__m256d start    = gatherPairTable(table.lenSqrStart, pairIndices);
+	__m256d position = _mm256_mul_pd(_mm256_sub_pd(_mm256_max_pd(lenSqr, start), start),
+	                                 gatherPairTable(table.invStep, pairIndices));
+
+	__m128i interval = _mm256_cvttpd_epi32(_mm256_min_pd(position, _mm256_set1_pd(table.intervals - 1)));
+	__m256d u        = _mm256_sub_pd(position, _mm256_cvtepi32_pd(interval));
+
+	__m128i blocks = _mm_mullo_epi32(_mm_add_epi32(_mm_mullo_epi32(pairIndices, _mm_set1_epi32(table.intervals)), interval),
+	                                 _mm_set1_epi32(LENNARD_JONES_TABLE_COEFFS));
+
+	__m256d coeffs[LENNARD_JONES_TABLE_COEFFS];
+	for (size_t coeffI = 0; coeffI < LENNARD_JONES_TABLE_COEFFS; ++coeffI)
+		coeffs[coeffI] = gatherPairTable(table.coeffs + coeffI, blocks);
+
+	forceOverDist = _mm256_fmadd_pd(_mm256_fmadd_pd(_mm256_fmadd_pd(coeffs[3], u, coeffs[2]), u, coeffs[1]), u, coeffs[0]);
+	energy        = _mm256_fmadd_pd(_mm256_fmadd_pd(_mm256_fmadd_pd(coeffs[7], u, coeffs[6]), u, coeffs[5]), u, coeffs[4]);
+}
+
+template<typename Gas>
+void arraysAttract(PhysVal_t& potEnergy, MoleculeArrays& mols, size_t molA, const size_t* partners, size_t partnerCount,
+                   const Vector& period, const AttractionShell& shell, const LennardJonesTable* table)
+{
+	if constexpr (!Gas::ATTRACTS) return;
+
+	const __m256d coordX = _mm256_set1_pd(mols.x[molA]);
+	const __m256d coordY = _mm256_set1_pd(mols.y[molA]);
+	const __m256d coordZ = _mm256_set1_pd(mols.z[molA]);
+
+	const bool    periodic = isPeriodic(period);
+	const __m256d periodX  = _mm256_set1_pd(period.x);
+	const __m256d periodY  = _mm256_set1_pd(period.y);
+	const __m256d periodZ  = _mm256_set1_pd(period.z);
+
+	const __m256d fromSqr    = _mm256_set1_pd(shell.fromSqr);
+	const __m256d toSqr      = _mm256_set1_pd(shell.toSqr);
+	const __m256d forceScale = _mm256_set1_pd(shell.forceScale);
+	const __m128i pairRow    = _mm_set1_epi32(mols.type[molA] * TYPES_COUNT);
+
+	__m256d forceX = _mm256_setzero_pd();
+	__m256d forceY = _mm256_setzero_pd();
+	__m256d forceZ = _mm256_setzero_pd();
+	__m256d energy = _mm256_setzero_pd();
+
+	size_t partnerI = 0;
+	for (; partnerI + 4 <= partnerCount; partnerI += 4)
+	{
+		__m256i indices = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(partners + partnerI));
+
+		__m256d diffX = _mm256_sub_pd(coordX, gatherCoords(mols.x, indices));
+		__m256d diffY = _mm256_sub_pd(coordY, gatherCoords(mols.y, indices));
+		__m256d diffZ = _mm256_sub_pd(coordZ, gatherCoords(mols.z, indices));
+
+		if (periodic)
+		{
+			diffX = nearestImage(diffX, periodX);
+			diffY = nearestImage(diffY, periodY);
+			diffZ = nearestImage(diffZ, periodZ);
+		}
+
+		__m256d lenSqr = _mm256_fmadd_pd(diffZ, diffZ, _mm256_fmadd_pd(diffY, diffY, _mm256_mul_pd(diffX, diffX)));
+
+		__m256d inRange = _mm256_and_pd(_mm256_cmp_pd(lenSqr, toSqr, _CMP_LE_OQ), _mm256_cmp_pd(lenSqr, fromSqr, _CMP_GT_OQ));
+		if (_mm256_testz_pd(inRange, inRange)) continue;
+
+		__m128i pairIndices = _mm_add_epi32(pairRow, _mm256_i64gather_epi32(mols.type, indices, 4));
+
+		__m256d closestSqr = gatherPairTable(LENNARD_JONES_CLOSEST_SQR, pairIndices);
+		__m256d tooClose   = _mm256_cmp_pd(lenSqr, closestSqr, _CMP_LT_OQ);
+
+		__m256d forceOverDist, pairEnergy;
+		if (table)
+		{
+			tableLookup(*table, lenSqr, pairIndices, forceOverDist, pairEnergy);
+		}
+		else
+		{
+			__m256d power2 = _mm256_div_pd(_mm256_set1_pd(1.0), _mm256_max_pd(lenSqr, closestSqr));
+			__m256d power6 = _mm256_mul_pd(_mm256_mul_pd(power2, power2), power2);
+
+			forceOverDist = _mm256_mul_pd(_mm256_mul_pd(
+				_mm256_fmadd_pd(gatherPairTable(LENNARD_JONES_FORCE_A, pairIndices), power6,
+				                gatherPairTable(LENNARD_JONES_FORCE_B, pairIndices)), power6), power2);
+
+			pairEnergy = _mm256_mul_pd(
+				_mm256_fmadd_pd(gatherPairTable(LENNARD_JONES_POTENTIAL_A, pairIndices), power6,
+				                gatherPairTable(LENNARD_JONES_POTENTIAL_B, pairIndices)), power6);
+		}
+
+		forceOverDist = _mm256_and_pd(_mm256_andnot_pd(tooClose, _mm256_mul_pd(forceOverDist, forceScale)), inRange);
+		energy = _mm256_add_pd(energy, _mm256_and_pd(pairEnergy, inRange));
+
+		__m256d pairForceX = _mm256_mul_pd(diffX, forceOverDist);
+		__m256d pairForceY = _mm256_mul_pd(diffY, forceOverDist);
+		__m256d pairForceZ = _mm256_mul_pd(diffZ, forceOverDist);
+
+		forceX = _mm256_add_pd(forceX, pairForceX);
+		forceY = _mm256_add_pd(forceY, pairForceY);
+		forceZ = _mm256_add_pd(forceZ, pairForceZ);
+
+		// No scatter in AVX2:
+		alignas(32) PhysVal_t lanesX[4], lanesY[4], lanesZ[4];
+		_mm256_store_pd(lanesX, pairForceX);
+		_mm256_store_pd(lanesY, pairForceY);
+		_mm256_store_pd(lanesZ, pairForceZ);
+
+		for (size_t lane = 0; lane < 4; ++lane)
+		{
+			size_t molB = partners[partnerI + lane];
+
+			mols.forceX[molB] += lanesX[lane];
+			mols.forceY[molB] += lanesY[lane];
+			mols.forceZ[molB] += lanesZ[lane];
+		}
+	}
+
+	mols.forceX[molA] -= horizontalSum(forceX);
+	mols.forceY[molA] -= horizontalSum(forceY);
+	mols.forceZ[molA] -= horizontalSum(forceZ);
+	potEnergy += horizontalSum(energy);
+
+	for (; partnerI < partnerCount; ++partnerI)
+		attractOnePair(potEnergy, mols, molA, partners[partnerI], period, shell, table);
+}
+
+//==============================================
+// MIXED-PRECISION KERNELS
+//==============================================
+
+static_assert(TYPES_COUNT_SQR <= 8, "Pair constants have to fit into one register of floats");
+
+// Pair constants rounded to float once, a permute picks eight of them at a time
+struct FloatPairConstants
+{
+	alignas(32) float closestSqr [8];
+	alignas(32) float forceA     [8];
+	alignas(32) float forceB     [8];
+	alignas(32) float potentialA [8];
+	alignas(32) float potentialB [8];
+};
+
+FloatPairConstants floatPairConstants()
+{
+	FloatPairConstants constants = {};
+	for (size_t pairI = 0; pairI < TYPES_COUNT_SQR; ++pairI)
+	{
+		constants.closestSqr[pairI] = LENNARD_JONES_CLOSEST_SQR[pairI];
+		constants.forceA    [pairI] = LENNARD_JONES_FORCE_A    [pairI];
+		constants.forceB    [pairI] = LENNARD_JONES_FORCE_B    [pairI];
+		constants.potentialA[pairI] = LENNARD_JONES_POTENTIAL_A[pairI];
+		constants.potentialB[pairI] = LENNARD_JONES_POTENTIAL_B[pairI];
+	}
+
+	return constants;
+}
+
+const FloatPairConstants FLOAT_PAIR_CONSTANTS = floatPairConstants();
+
+inline __m256 pairConstant(const float* constants, __m256i pairIndices)
+{
+	return _mm256_permutevar8x32_ps(_mm256_load_ps(constants), pairIndices);
+}
+
+// Molecules low and high in the lower and the upper half of a register
+inline __m256 loadPackedPair(const float* packed, size_t low, size_t high)
+{
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(packed + 4 * low)), _mm_load_ps(packed + 4 * high), 1);
+}
+
+// Eight partners turned from four floats each into a register per coordinate and one of types
+inline void loadPacked8(const float* packed, const size_t* partners, __m256& x, __m256& y, __m256& z, __m256i& type)
+{
+	__m256 mols01 = _mm256_unpacklo_ps(loadPackedPair(packed, partners[0], partners[4]), loadPackedPair(packed, partners[1], partners[5]));
+	__m256 mols23 = _mm256_unpacklo_ps(loadPackedPair(packed, partners[2], partners[6]), loadPackedPair(packed, partners[3], partners[7]));
+	__m256 rest01 = _mm256_unpackhi_ps(loadPackedPair(packed, partners[0], partners[4]), loadPackedPair(packed, partners[1], partners[5]));
+	__m256 rest23 = _mm256_unpackhi_ps(loadPackedPair(packed, partners[2], partners[6]), loadPackedPair(packed, partners[3], partners[7]));
+
+	x    = _mm256_shuffle_ps(mols01, mols23, 0x44);
+	y    = _mm256_shuffle_ps(mols01, mols23, 0xEE);
+	z    = _mm256_shuffle_ps(rest01, rest23, 0x44);
+	type = _mm256_castps_si256(_mm256_shuffle_ps(rest01, rest23, 0xEE));
+}
+
+inline __m256 packedLenSqr(const float* packed, size_t molA, const size_t* partners, const Vector& period, bool periodic,
+                           __m256& diffX, __m256& diffY, __m256& diffZ, __m256i& types)
+{
+	__m256 x, y, z;
+	loadPacked8(packed, partners, x, y, z, types);
+
+	diffX = _mm256_sub_ps(_mm256_set1_ps(packed[4 * molA + 0]), x);
+	diffY = _mm256_sub_ps(_mm256_set1_ps(packed[4 * molA + 1]), y);
+	diffZ = _mm256_sub_ps(_mm256_set1_ps(packed[4 * molA + 2]), z);
+
+	if (periodic)
+	{
+		diffX = nearestImage(diffX, _mm256_set1_ps(period.x));
+		diffY = nearestImage(diffY, _mm256_set1_ps(period.y));
+		diffZ = nearestImage(diffZ, _mm256_set1_ps(period.z));
+	}
+
+	return _mm256_fmadd_ps(diffZ, diffZ, _mm256_fmadd_ps(diffY, diffY, _mm256_mul_ps(diffX, diffX)));
+}
+
+// The last block of partners is padded with its first partner, lanes past the end are masked off
+inline const size_t* packedBlock(const size_t* partners, size_t partnerI, size_t partnerCount, size_t* tail, __m256& lanes)
+{
+	size_t left = partnerCount - partnerI;
+	if (left >= 8)
+	{
+		lanes = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		return partners + partnerI;
+	}
+
+	for (size_t lane = 0; lane < 8; ++lane)
+		tail[lane] = partners[partnerI + ((lane < left)? lane : 0)];
+
+	lanes = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(left), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+	return tail;
+}
+
+// Float distances only pick the blocks to look at, so contact is taken with a margin for their rounding.
+// Collisions themselves are moleculesCollide in double.
+const float PACKED_CONTACT_MARGIN = 1.01f;
+
+template<typename Gas>
+void packedCollideAll(MoleculeArrays& mols, Molecule* molecules, size_t molA, const size_t* partners, size_t partnerCount,
+                      const GasContainer& box, bool splitShift)
+{
+	if constexpr (!Gas::COLLIDES) return;
+
+	const __m256 contactSqr = _mm256_set1_ps(MAXIMUM_COLLISION_RADIUS_SQUAREx4 * PACKED_CONTACT_MARGIN);
+	const bool   periodic   = isPeriodic(box.period);
+
+	size_t tail[8];
+	for (size_t partnerI = 0; partnerI < partnerCount; partnerI += 8)
+	{
+		__m256 lanes;
+		const size_t* block = packedBlock(partners, partnerI, partnerCount, tail, lanes);
+
+		__m256 diffX, diffY, diffZ;
+		__m256i types;
+		__m256 lenSqr = packedLenSqr(mols.packed, molA, block, box.period, periodic, diffX, diffY, diffZ, types);
+
+		int inContact = _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(lenSqr, contactSqr, _CMP_LE_OQ), lanes));
+		if (inContact == 0) continue;
+
+		// A shifts with every collision, so the rest of the block is redone one by one:
+		size_t laneEnd = std::min<size_t>(8, partnerCount - partnerI);
+		for (size_t lane = __builtin_ctz(inContact); lane < laneEnd; ++lane)
+		{
+			size_t molB = block[lane];
+
+			moleculesCollide<Gas>(molecules[molA], molecules[molB], box, splitShift);
+			packMolecule(mols.packed + 4 * molA, molecules[molA]);
+			packMolecule(mols.packed + 4 * molB, molecules[molB]);
+		}
+	}
+}
+
+// Eight spline lookups; every lane reads its 32-byte block of coefficients, the blocks are transposed in registers
+inline void floatTableLookup(const LennardJonesTable& table, __m256 lenSqr, __m256i pairIndices, __m256 starts, __m256 invSteps,
+                             __m256& forceOverDist, __m256& energy)
+{
+	__m256 start    = _mm256_permutevar8x32_ps(starts, pairIndices);
+	__m256 position = _mm256_mul_ps(_mm256_sub_ps(_mm256_max_ps(lenSqr, start), start), _mm256_permutevar8x32_ps(invSteps, pairIndices));
+
+	__m256i interval = _mm256_cvttps_epi32(_mm256_min_ps(position, _mm256_set1_ps(table.intervals - 1)));
+	__m256  u        = _mm256_sub_ps(position, _mm256_cvtepi32_ps(interval));
+
+	alignas(32) int32_t blocks[8];
+	_mm256_store_si256(reinterpret_cast<__m256i*>(blocks),
+	                   _mm256_slli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(pairIndices, _mm256_set1_epi32(table.intervals)), interval), 3));
+
+	__m256 rows[8];
+	for (size_t lane = 0; lane < 8; ++lane)
+		rows[lane] = _mm256_load_ps(table.floatCoeffs + blocks[lane]);
+
+	__m256 low01  = _mm256_unpacklo_ps(rows[0], rows[1]), high01 = _mm256_unpackhi_ps(rows[0], rows[1]);
+	__m256 low23  = _mm256_unpacklo_ps(rows[2], rows[3]), high23 = _mm256_unpackhi_ps(rows[2], rows[3]);
+	__m256 low45  = _mm256_unpacklo_ps(rows[4], rows[5]), high45 = _mm256_unpackhi_ps(rows[4], rows[5]);
+	__m256 low67  = _mm256_unpacklo_ps(rows[6], rows[7]), high67 = _mm256_unpackhi_ps(rows[6], rows[7]);
+
+	__m256 even0123 = _mm256_shuffle_ps(low01,  low23,  0x44), odd0123 = _mm256_shuffle_ps(low01,  low23,  0xEE);
+	__m256 even4567 = _mm256_shuffle_ps(low45,  low67,  0x44), odd4567 = _mm256_shuffle_ps(low45,  low67,  0xEE);
+	__m256 next0123 = _mm256_shuffle_ps(high01, high23, 0x44), last0123 = _mm256_shuffle_ps(high01, high23, 0xEE);
+	__m256 next4567 = _mm256_shuffle_ps(high45, high67, 0x44), last4567 = _mm256_shuffle_ps(high45, high67, 0xEE);
+
+	__m256 coeffs[LENNARD_JONES_TABLE_COEFFS] =
+	{
+		_mm256_permute2f128_ps(even0123, even4567, 0x20),
+		_mm256_permute2f128_ps( odd0123,  odd4567, 0x20),
+		_mm256_permute2f128_ps(next0123, next4567, 0x20),
+		_mm256_permute2f128_ps(last0123, last4567, 0x20),
+		_mm256_permute2f128_ps(even0123, even4567, 0x31),
+		_mm256_permute2f128_ps( odd0123,  odd4567, 0x31),
+		_mm256_permute2f128_ps(next0123, next4567, 0x31),
+		_mm256_permute2f128_ps(last0123, last4567, 0x31)
+	};
+
+	forceOverDist = _mm256_fmadd_ps(_mm256_fmadd_ps(_mm256_fmadd_ps(coeffs[3], u, coeffs[2]), u, coeffs[1]), u, coeffs[0]);
+	energy        = _mm256_fmadd_ps(_mm256_fmadd_ps(_mm256_fmadd_ps(coeffs[7], u, coeffs[6]), u, coeffs[5]), u, coeffs[4]);
+}
+
+inline __m256d lowToDouble(__m256 reg)
+{
+	return _mm256_cvtps_pd(_mm256_castps256_ps128(reg));
+}
+
+inline __m256d highToDouble(__m256 reg)
+{
+	return _mm256_cvtps_pd(_mm256_extractf128_ps(reg, 1));
+}
+
+// Forces of eight partners turned back into x, y, z, 0 per partner and added to their vectors in double
+inline void addPartnerForces(Vector* forces, const size_t* partners, __m256 forceX, __m256 forceY, __m256 forceZ)
+{
+	__m256 xy01 = _mm256_unpacklo_ps(forceX, forceY), xy23 = _mm256_unpackhi_ps(forceX, forceY);
+	__m256 z01  = _mm256_unpacklo_ps(forceZ, _mm256_setzero_ps()), z23 = _mm256_unpackhi_ps(forceZ, _mm256_setzero_ps());
+
+	__m256 partnerPairs[4] =
+	{
+		_mm256_shuffle_ps(xy01, z01, 0x44),
+		_mm256_shuffle_ps(xy01, z01, 0xEE),
+		_mm256_shuffle_ps(xy23, z23, 0x44),
+		_mm256_shuffle_ps(xy23, z23, 0xEE)
+	};
+
+	for (size_t lane = 0; lane < 4; ++lane)
+	{
+		Vector& lowForce  = forces[partners[lane]];
+		Vector& highForce = forces[partners[lane + 4]];
+
+		lowForce .reg256 = _mm256_add_pd(lowForce .reg256, lowToDouble (partnerPairs[lane]));
+		highForce.reg256 = _mm256_add_pd(highForce.reg256, highToDouble(partnerPairs[lane]));
+	}
+}
+
+template<typename Gas>
+void packedAttract(PhysVal_t& potEnergy, const MoleculeArrays& mols, const Molecule* molecules, Vector* forces, size_t molA,
+                   const size_t* partners, size_t partnerCount, const Vector& period,
+                   const AttractionShell& shell, const LennardJonesTable* table)
+{
+	if constexpr (!Gas::ATTRACTS) return;
+
+	const bool    periodic   = isPeriodic(period);
+	const __m256  fromSqr    = _mm256_set1_ps(shell.fromSqr);
+	const __m256  toSqr      = _mm256_set1_ps(shell.toSqr);
+	const __m256  forceScale = _mm256_set1_ps(shell.forceScale);
+	const __m256i pairRow    = _mm256_set1_epi32(molecules[molA].type * TYPES_COUNT);
+
+	const __m256 starts   = table? _mm256_load_ps(table->floatLenSqrStart) : _mm256_setzero_ps();
+	const __m256 invSteps = table? _mm256_load_ps(table->floatInvStep)     : _mm256_setzero_ps();
+
+	__m256d forceX = _mm256_setzero_pd();
+	__m256d forceY = _mm256_setzero_pd();
+	__m256d forceZ = _mm256_setzero_pd();
+	__m256d energy = _mm256_setzero_pd();
+
+	size_t tail[8];
+	for (size_t partnerI = 0; partnerI < partnerCount; partnerI += 8)
+	{
+		__m256 lanes;
+		const size_t* block = packedBlock(partners, partnerI, partnerCount, tail, lanes);
+
+		__m256 diffX, diffY, diffZ;
+		__m256i types;
+		__m256 lenSqr = packedLenSqr(mols.packed, molA, block, period, periodic, diffX, diffY, diffZ, types);
+
+		__m256 inRange = _mm256_and_ps(_mm256_cmp_ps(lenSqr, toSqr, _CMP_LE_OQ), _mm256_cmp_ps(lenSqr, fromSqr, _CMP_GT_OQ));
+		inRange = _mm256_and_ps(inRange, lanes);
+		if (_mm256_testz_ps(inRange, inRange)) continue;
+
+		__m256i pairIndices = _mm256_add_epi32(pairRow, types);
+
+		__m256 closestSqr = pairConstant(FLOAT_PAIR_CONSTANTS.closestSqr, pairIndices);
+		__m256 tooClose   = _mm256_cmp_ps(lenSqr, closestSqr, _CMP_LT_OQ);
+
+		__m256 forceOverDist, pairEnergy;
+		if (table)
+		{
+			floatTableLookup(*table, lenSqr, pairIndices, starts, invSteps, forceOverDist, pairEnergy);
+		}
+		else
+		{
+			__m256 power2 = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_max_ps(lenSqr, closestSqr));
+			__m256 power6 = _mm256_mul_ps(_mm256_mul_ps(power2, power2), power2);
+
+			forceOverDist = _mm256_mul_ps(_mm256_mul_ps(
+				_mm256_fmadd_ps(pairConstant(FLOAT_PAIR_CONSTANTS.forceA, pairIndices), power6,
+				                pairConstant(FLOAT_PAIR_CONSTANTS.forceB, pairIndices)), power6), power2);
+
+			pairEnergy = _mm256_mul_ps(
+				_mm256_fmadd_ps(pairConstant(FLOAT_PAIR_CONSTANTS.potentialA, pairIndices), power6,
+				                pairConstant(FLOAT_PAIR_CONSTANTS.potentialB, pairIndices)), power6);
+		}
+
+		forceOverDist = _mm256_and_ps(_mm256_andnot_ps(tooClose, _mm256_mul_ps(forceOverDist, forceScale)), inRange);
+		pairEnergy    = _mm256_and_ps(pairEnergy, inRange);
+
+		energy = _mm256_add_pd(energy, _mm256_add_pd(lowToDouble(pairEnergy), highToDouble(pairEnergy)));
+
+		__m256 pairForceX = _mm256_mul_ps(diffX, forceOverDist);
+		__m256 pairForceY = _mm256_mul_ps(diffY, forceOverDist);
+		__m256 pairForceZ = _mm256_mul_ps(diffZ, forceOverDist);
+
+		forceX = _mm256_add_pd(forceX, _mm256_add_pd(lowToDouble(pairForceX), highToDouble(pairForceX)));
+		forceY = _mm256_add_pd(forceY, _mm256_add_pd(lowToDouble(pairForceY), highToDouble(pairForceY)));
+		forceZ = _mm256_add_pd(forceZ, _mm256_add_pd(lowToDouble(pairForceZ), highToDouble(pairForceZ)));
+
+		addPartnerForces(forces, block, pairForceX, pairForceY, pairForceZ);
+	}
+
+	forces[molA].x -= horizontalSum(forceX);
+	forces[molA].y -= horizontalSum(forceY);
+	forces[molA].z -= horizontalSum(forceZ);
+	potEnergy += horizontalSum(energy);
+}
@@ -0,0 +1,72 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef GAS_MODEL_MOLECULE_ARRAYS_HPP_INCLUDED
+#define GAS_MODEL_MOLECULE_ARRAYS_HPP_INCLUDED
+
+#include "Molecule.hpp"
+#include "Walls.hpp"
+
+#include <cstddef>
+
+// Structure-of-arrays copy of the molecules the vectorized interaction kernels run on.
+// Every array is 64-byte aligned and padded to a whole number of cache lines.
+// With float coordinates on, only the packed coordinates are kept: the mixed-precision kernels
+// change the molecules and forces in place, so there is nothing to store back.
+struct MoleculeArrays
+{
+	MoleculeArrays();
+	~MoleculeArrays();
+
+	// Arrays of the other layout are freed:
+	void setFloatCoords(bool on);
+	void reserve(size_t count);
+
+	// Forces are only carried by attracting gases and may be nullptr:
+	void load (const Molecule* molecules, const Vector* forces, size_t first, size_t last);
+	void store(      Molecule* molecules,       Vector* forces, size_t first, size_t last) const;
+
+	PhysVal_t* x;
+	PhysVal_t* y;
+	PhysVal_t* z;
+
+	PhysVal_t* speedX;
+	PhysVal_t* speedY;
+	PhysVal_t* speedZ;
+
+	PhysVal_t* forceX;
+	PhysVal_t* forceY;
+	PhysVal_t* forceZ;
+
+	int* type;
+
+	// With float coordinates, x, y, z and the bits of the type of every molecule, 16 bytes each:
+	bool floatCoords;
+	float* packed;
+
+	size_t capacity;
+};
+
+// Partners are seen at their nearest periodic images, shifts are split and bounced as in moleculesCollide
+template<typename Gas>
+void arraysCollide(MoleculeArrays& mols, size_t molA, size_t molB, const GasContainer& box, bool splitShift = false);
+template<typename Gas>
+void arraysCollideAll(MoleculeArrays& mols, size_t molA, const size_t* partners, size_t partnerCount, const GasContainer& box,
+                      bool splitShift = false);
+
+// Lennard-Jones between molecule molA and all of its partners, four pairs per AVX2 register.
+// Analytic unless a table is given.
+template<typename Gas>
+void arraysAttract(PhysVal_t& potEnergy, MoleculeArrays& mols, size_t molA, const size_t* partners, size_t partnerCount,
+                   const Vector& period, const AttractionShell& shell = FULL_ATTRACTION_SHELL,
+                   const LennardJonesTable* table = nullptr);
+
+// Mixed precision: partners are read from the packed floats, one 16-byte load each, eight pairs per AVX2 register.
+// Collisions and forces go to the molecules and forces themselves, forces and energy are summed in double.
+template<typename Gas>
+void packedCollideAll(MoleculeArrays& mols, Molecule* molecules, size_t molA, const size_t* partners, size_t partnerCount,
+                      const GasContainer& box, bool splitShift = false);
+template<typename Gas>
+void packedAttract(PhysVal_t& potEnergy, const MoleculeArrays& mols, const Molecule* molecules, Vector* forces, size_t molA,
+                   const size_t* partners, size_t partnerCount, const Vector& period,
+                   const AttractionShell& shell = FULL_ATTRACTION_SHELL, const LennardJonesTable* table = nullptr);
+
+#endif // GAS_MODEL_MOLECULE_ARRAYS_HPP_INCLUDED
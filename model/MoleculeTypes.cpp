@@ -25,6 +25,11 @@ PhysVal_t LennardJonesPotentialB(MoleculeType typeA, MoleculeType typeB)
 	       std::pow(COLLISION_RADIUS[typeA] + COLLISION_RADIUS[typeB],  6);
 }
 
+PhysVal_t LennardJonesClosestSqr(MoleculeType typeA, MoleculeType typeB)
+{
+	return std::pow(1.0001 * (COLLISION_RADIUS[typeA] + COLLISION_RADIUS[typeB]), 2);
+}
+
 PhysVal_t LennardJonesForce(MoleculeType typeA, MoleculeType typeB, PhysVal_t distance)
 {
 	// Below 2^(1/6) * <sum of radiuses> force rockets to infinity 
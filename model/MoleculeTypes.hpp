@@ -96,11 +96,44 @@ const PhysVal_t LENNARD_JONES_POTENTIAL_B[TYPES_COUNT_SQR] =
 	LennardJonesPotentialB( ARGON,  ARGON)
 };
 
+// Squared distance below which the force is cut off, for kernels that never take a root
+PhysVal_t LennardJonesClosestSqr(MoleculeType typeA, MoleculeType typeB);
+
+const PhysVal_t LENNARD_JONES_CLOSEST_SQR[TYPES_COUNT_SQR] = 
+{
+	LennardJonesClosestSqr(HELIUM, HELIUM),
+	LennardJonesClosestSqr(HELIUM,  ARGON),
+	LennardJonesClosestSqr( ARGON, HELIUM),
+	LennardJonesClosestSqr( ARGON,  ARGON)
+};
+
 const PhysVal_t POTENTIAL_CUTOFF_MAX_RADIUS          = 7 * MAXIMUM_COLLISION_RADIUS;
-const PhysVal_t POTENTIAL_CUTOFF_MAX_RADIUS_SQUAREx4 = 4 * std::pow(POTENTIAL_CUTOFF_MAX_RADIUS, 2);
+const PhysVal_t POTENTIAL_CUTOFF_MAX_RADIUS_SQUARE   = std::pow(POTENTIAL_CUTOFF_MAX_RADIUS, 2);
+
+// Largest distances at which moleculesCollide and moleculesAttract still do anything
+const PhysVal_t COLLISION_INTERACTION_RANGE = 2 * MAXIMUM_COLLISION_RADIUS;
+const PhysVal_t POTENTIAL_INTERACTION_RANGE = POTENTIAL_CUTOFF_MAX_RADIUS;
 
 PhysVal_t LennardJonesForce    (MoleculeType typeA, MoleculeType typeB, PhysVal_t distance);
 PhysVal_t LennardJonesPotential(MoleculeType typeA, MoleculeType typeB, PhysVal_t distance);
 
+//==============================================
+// LONG-RANGE INTERACTION PROPERTIES
+//==============================================
+// F = K * qA * qB * r/|r|^3
+// U = K * qA * qB / |r|
+// Coulomb: K = k, charges in elementary charges
+// Gravity: K = -G, masses for charges
+//==============================================
+
+const PhysVal_t CHARGES[TYPES_COUNT] =
+{
+	0.0, // He
+	0.0  // Ar
+};
+
+const PhysVal_t COULOMB_CONSTANT       = SAS_2_Model(1.389e29, -2, 3,  1);
+const PhysVal_t GRAVITATIONAL_CONSTANT = SAS_2_Model(1.108e-7, -2, 3, -1);
+
 
 #endif // GAS_MODEL_MOLECULE_TYPES_HPP_INCLUDED
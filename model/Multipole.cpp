@@ -0,0 +1,96 @@
+// No Copyright. Vladislav Aleinik 2019
+#include "Multipole.hpp"
+
+#include <cmath>
+
+// Axes of the kept quadrupole components
+const unsigned QUADRUPOLE_AXES[6][2] = {{0, 0}, {1, 1}, {2, 2}, {0, 1}, {0, 2}, {1, 2}};
+
+void Multipole::initSource(Vector coords, PhysVal_t newStrength)
+{
+	center   = coords;
+	dipole   = Vector(0.0, 0.0, 0.0);
+	strength = newStrength;
+	weight   = std::fabs(newStrength);
+
+	for (size_t i = 0; i < 6; ++i)
+		quadrupole[i] = 0.0;
+}
+
+void Multipole::combine(const Multipole* children, size_t count, Vector geometricCenter, MultipoleOrder order)
+{
+	strength = 0.0;
+	weight   = 0.0;
+
+	Vector weighted = Vector(0.0, 0.0, 0.0);
+	for (size_t childI = 0; childI < count; ++childI)
+	{
+		strength += children[childI].strength;
+		weight   += children[childI].weight;
+		weighted += children[childI].center * children[childI].weight;
+	}
+
+	center = (weight != 0.0)? weighted / weight : geometricCenter;
+	dipole = Vector(0.0, 0.0, 0.0);
+
+	for (size_t i = 0; i < 6; ++i)
+		quadrupole[i] = 0.0;
+
+	for (size_t childI = 0; childI < count; ++childI)
+	{
+		const Multipole& child = children[childI];
+
+		Vector shift = child.center - center;
+		dipole += child.dipole + shift * child.strength;
+
+		if (order != QUADRUPOLE_ORDER) continue;
+
+		// M' = M + 3(p t + t p) - 2(p.t) I + q (3 t t - |t|^2 I):
+		PhysVal_t t[3] = {shift.x,        shift.y,        shift.z};
+		PhysVal_t p[3] = {child.dipole.x, child.dipole.y, child.dipole.z};
+
+		PhysVal_t dipoleShift = shift.scalar(child.dipole);
+		PhysVal_t shiftSqr    = shift.lenSqr();
+
+		for (size_t i = 0; i < 6; ++i)
+		{
+			unsigned a = QUADRUPOLE_AXES[i][0];
+			unsigned b = QUADRUPOLE_AXES[i][1];
+			PhysVal_t diagonal = (a == b)? 1.0 : 0.0;
+
+			quadrupole[i] += child.quadrupole[i] + 3 * (p[a] * t[b] + t[a] * p[b]) - 2 * dipoleShift * diagonal +
+			                 child.strength * (3 * t[a] * t[b] - shiftSqr * diagonal);
+		}
+	}
+}
+
+inline void Multipole::addField(Vector point, MultipoleOrder order, Vector& field, PhysVal_t& potential) const
+{
+	Vector r = point - center;
+
+	PhysVal_t invLenSqr = 1 / r.lenSqr();
+	PhysVal_t invLen    = std::sqrt(invLenSqr);
+	PhysVal_t invLen3   = invLen * invLenSqr;
+
+	potential += strength * invLen;
+	field     += r * (strength * invLen3);
+
+	// Dipole: 3(p.r) r/|r|^5 - p/|r|^3
+	PhysVal_t dipoleR = dipole.scalar(r);
+
+	potential += dipoleR * invLen3;
+	field     += r * (3 * dipoleR * invLen3 * invLenSqr) - dipole * invLen3;
+
+	if (order != QUADRUPOLE_ORDER) return;
+
+	// Quadrupole: 5/2 (r.M.r) r/|r|^7 - M.r/|r|^5
+	Vector quadrupoleR = Vector(quadrupole[0] * r.x + quadrupole[3] * r.y + quadrupole[4] * r.z,
+	                            quadrupole[3] * r.x + quadrupole[1] * r.y + quadrupole[5] * r.z,
+	                            quadrupole[4] * r.x + quadrupole[5] * r.y + quadrupole[2] * r.z);
+
+	PhysVal_t rQuadrupoleR = r.scalar(quadrupoleR);
+	PhysVal_t invLen5      = invLen3 * invLenSqr;
+
+	potential += 0.5 * rQuadrupoleR * invLen5;
+	field     += r * (2.5 * rQuadrupoleR * invLen5 * invLenSqr) - quadrupoleR * invLen5;
+}
@@ -0,0 +1,55 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef GAS_MODEL_MULTIPOLE_HPP_INCLUDED
+#define GAS_MODEL_MULTIPOLE_HPP_INCLUDED
+
+#include "Vector.hpp"
+
+#include <cstddef>
+
+//==============================================
+// MULTIPOLE EXPANSIONS
+//==============================================
+// Sources q_k at x_k seen from a point at r from
+// the center c, d_k = x_k - c:
+// phi = Q/|r| + p.r/|r|^3 + r.M.r/(2|r|^5)
+// p   = sum q_k d_k
+// M   = sum q_k (3 d_k d_k - |d_k|^2 I)
+// The center is weighted by |q|, so that masses
+// have no dipole and charges of both signs
+// still have a center.
+//==============================================
+
+// Terms kept in the expansion of a tree node
+enum MultipoleOrder
+{
+	DIPOLE_ORDER     = 1,
+	QUADRUPOLE_ORDER = 2
+};
+
+// Nodes narrower than this share of their distance count as a whole
+const PhysVal_t DEFAULT_OPENING_ANGLE = 0.5;
+
+struct Multipole
+{
+	Vector center;
+	Vector dipole;
+	PhysVal_t strength;
+	PhysVal_t weight;
+
+	// Traceless, so only xx yy zz xy xz yz are kept
+	PhysVal_t quadrupole[6];
+
+	Multipole() = default;
+
+	// A single source sits at the center
+	void initSource(Vector coords, PhysVal_t newStrength);
+
+	// Children are shifted to the new center and summed up.
+	// Nodes with nothing charged in them keep the geometric center.
+	void combine(const Multipole* children, size_t count, Vector geometricCenter, MultipoleOrder order);
+
+	// Adds the field -grad(phi) and phi at the point
+	inline void addField(Vector point, MultipoleOrder order, Vector& field, PhysVal_t& potential) const;
+};
+
+#endif // GAS_MODEL_MULTIPOLE_HPP_INCLUDED
@@ -0,0 +1,176 @@
+// No Copyright. Vladislav Aleinik 2019
+#include "NeighborList.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+// Molecules handed to one thread at a time while the lists are built
+const size_t NEIGHBOR_LIST_CHUNK = 1024;
+
+NeighborList::NeighborList(Vector boxSize, PhysVal_t newRange, PhysVal_t newSkin) :
+	range            (newRange),
+	skin             (newSkin),
+	innerRange       (newRange),
+	period           (std::numeric_limits<PhysVal_t>::infinity(),
+	                  std::numeric_limits<PhysVal_t>::infinity(),
+	                  std::numeric_limits<PhysVal_t>::infinity()),
+	starts           (nullptr),
+	innerEnds        (nullptr),
+	neighbors        (nullptr),
+	neighborCapacity (0),
+	builtCoords      (nullptr),
+	builtCount       (0),
+	valid            (false),
+	rebuildCount     (0),
+	cells            (boxSize, newRange + newSkin)
+{}
+
+NeighborList::~NeighborList()
+{
+	delete[] starts;
+	delete[] innerEnds;
+	delete[] neighbors;
+	delete[] builtCoords;
+}
+
+void NeighborList::setSkin(PhysVal_t newSkin)
+{
+	skin = newSkin;
+	cells.minCellSize = range + skin;
+
+	// Forces the cells to be laid out again on the next build:
+	delete[] cells.cellStarts;
+	cells.cellStarts = nullptr;
+
+	invalidate();
+}
+
+void NeighborList::setInnerRange(PhysVal_t newInnerRange)
+{
+	innerRange = newInnerRange;
+
+	invalidate();
+}
+
+void NeighborList::setPeriod(const Vector& newPeriod)
+{
+	period = newPeriod;
+	cells.setPeriod(newPeriod);
+
+	invalidate();
+}
+
+void NeighborList::invalidate()
+{
+	valid = false;
+}
+
+bool NeighborList::needsRebuild(const Molecule* molecules, size_t moleculeCount) const
+{
+	if (!valid || moleculeCount != builtCount) return true;
+
+	PhysVal_t maxShiftSqr = 0.25 * skin * skin;
+	for (size_t i = 0; i < moleculeCount; ++i)
+	{
+		// A molecule wrapped around a periodic axis has not moved by a period:
+		if (nearestImage(molecules[i].coords - builtCoords[i], period).lenSqr() > maxShiftSqr) return true;
+	}
+
+	return false;
+}
+
+void NeighborList::build(const Molecule* molecules, size_t moleculeCount, size_t ownCount, ThreadPool& threads)
+{
+	if (moleculeCount != builtCount || builtCoords == nullptr)
+	{
+		delete[] starts;
+		delete[] innerEnds;
+		delete[] builtCoords;
+
+		starts      = new size_t[moleculeCount + 1];
+		innerEnds   = new size_t[moleculeCount];
+		builtCoords = new Vector[moleculeCount];
+
+		if (!starts || !innerEnds || !builtCoords)
+		{
+			printf("NeighborList::build(): Unable to allocate memory!\n");
+			exit(1);
+		}
+	}
+
+	cells.build(molecules, moleculeCount);
+
+	PhysVal_t rangeSqr      = (range + skin) * (range + skin);
+	PhysVal_t innerRangeSqr = (innerRange + skin) * (innerRange + skin);
+	size_t chunkCount  = (moleculeCount + NEIGHBOR_LIST_CHUNK - 1) / NEIGHBOR_LIST_CHUNK;
+
+	// First pass counts partners, second one writes them down:
+	threads.parallelFor(chunkCount, [&](size_t chunkI, size_t)
+	{
+		size_t last = std::min(moleculeCount, (chunkI + 1) * NEIGHBOR_LIST_CHUNK);
+		for (size_t i = chunkI * NEIGHBOR_LIST_CHUNK; i < last; ++i)
+		{
+			size_t count = 0, innerCount = 0;
+			cells.forEachNeighbor(molecules, i, ownCount, [&](size_t partnerI)
+			{
+				PhysVal_t lenSqr = nearestImage(molecules[i].coords - molecules[partnerI].coords, period).lenSqr();
+
+				if (lenSqr <= rangeSqr)      ++count;
+				if (lenSqr <= innerRangeSqr) ++innerCount;
+			});
+
+			starts[i + 1] = count;
+			innerEnds[i]  = innerCount;
+			builtCoords[i] = molecules[i].coords;
+		}
+	});
+
+	starts[0] = 0;
+	for (size_t i = 0; i < moleculeCount; ++i)
+		starts[i + 1] += starts[i];
+
+	if (starts[moleculeCount] > neighborCapacity)
+	{
+		delete[] neighbors;
+
+		neighborCapacity = starts[moleculeCount] + starts[moleculeCount] / 4;
+		neighbors        = new size_t[neighborCapacity];
+
+		if (!neighbors)
+		{
+			printf("NeighborList::build(): Unable to allocate memory!\n");
+			exit(1);
+		}
+	}
+
+	threads.parallelFor(chunkCount, [&](size_t chunkI, size_t)
+	{
+		size_t last = std::min(moleculeCount, (chunkI + 1) * NEIGHBOR_LIST_CHUNK);
+		for (size_t i = chunkI * NEIGHBOR_LIST_CHUNK; i < last; ++i)
+		{
+			size_t innerCur = starts[i];
+			size_t outerCur = starts[i] + innerEnds[i];
+			innerEnds[i] = outerCur;
+
+			cells.forEachNeighbor(molecules, i, ownCount, [&](size_t partnerI)
+			{
+				PhysVal_t lenSqr = nearestImage(molecules[i].coords - molecules[partnerI].coords, period).lenSqr();
+
+				if      (lenSqr <= innerRangeSqr) neighbors[innerCur++] = partnerI;
+				else if (lenSqr <=      rangeSqr) neighbors[outerCur++] = partnerI;
+			});
+		}
+	});
+
+	builtCount = moleculeCount;
+	valid      = true;
+
+	++rebuildCount;
+}
+
+void NeighborList::update(const Molecule* molecules, size_t moleculeCount, size_t ownCount, ThreadPool& threads)
+{
+	if (needsRebuild(molecules, moleculeCount)) build(molecules, moleculeCount, ownCount, threads);
+}
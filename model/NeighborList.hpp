@@ -0,0 +1,54 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef GAS_MODEL_NEIGHBOR_LIST_HPP_INCLUDED
+#define GAS_MODEL_NEIGHBOR_LIST_HPP_INCLUDED
+
+#include "CellList.hpp"
+#include "Threading.hpp"
+
+// Verlet neighbor lists: every molecule remembers all partners within range + skin.
+// Lists stay valid until some molecule has moved by more than half the skin.
+class NeighborList
+{
+public:
+	NeighborList(Vector boxSize, PhysVal_t range, PhysVal_t skin);
+	~NeighborList();
+
+	void setSkin(PhysVal_t newSkin);
+	void setInnerRange(PhysVal_t newInnerRange);
+	void setPeriod(const Vector& newPeriod);
+	void invalidate();
+
+	bool needsRebuild(const Molecule* molecules, size_t moleculeCount) const;
+	// Lists hold every pair once, see visitsPair():
+	void build(const Molecule* molecules, size_t moleculeCount, size_t ownCount, ThreadPool& threads);
+
+	// Rebuilds the lists only if they went stale
+	void update(const Molecule* molecules, size_t moleculeCount, size_t ownCount, ThreadPool& threads);
+
+	PhysVal_t range;
+	PhysVal_t skin;
+	PhysVal_t innerRange;
+
+	// Distances and moves are taken between nearest periodic images:
+	Vector period;
+
+	// Partners of molecule i are neighbors[starts[i] .. starts[i + 1]).
+	// The ones within innerRange + skin go first and end at innerEnds[i], no pair gets
+	// into the inner range from after that before the lists go stale.
+	size_t* starts;
+	size_t* innerEnds;
+	size_t* neighbors;
+	size_t  neighborCapacity;
+
+	// Positions the lists were built for
+	Vector* builtCoords;
+	size_t  builtCount;
+	bool    valid;
+
+	size_t rebuildCount;
+
+private:
+	CellList cells;
+};
+
+#endif  // GAS_MODEL_NEIGHBOR_LIST_HPP_INCLUDED
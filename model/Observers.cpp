@@ -0,0 +1,188 @@
+// No Copyright. Vladislav Aleinik 2019
+#include "Observers.hpp"
+#include "Model.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+//==============================================
+// OBSERVATION FILES
+//==============================================
+
+ObservationFile::ObservationFile(const char* path, size_t newColumns) :
+	file    (fopen(path, "wb")),
+	columns (newColumns),
+	buffer  ()
+{
+	if (file == nullptr)
+	{
+		printf("ObservationFile::ctor(): Unable to open file \'%s\'\n", path);
+		exit(1);
+	}
+
+	ObservationHeader header = {};
+	memcpy(header.magic, OBSERVATION_MAGIC, sizeof(OBSERVATION_MAGIC));
+	header.version = OBSERVATION_VERSION;
+	header.columns = columns;
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1 || fflush(file) != 0)
+	{
+		printf("ObservationFile::ctor(): Unable to write to file \'%s\'\n", path);
+		exit(1);
+	}
+
+	buffer.reserve(OBSERVATION_BUFFER_ROWS * columns);
+}
+
+ObservationFile::~ObservationFile()
+{
+	flush();
+	fclose(file);
+}
+
+void ObservationFile::writeRow(size_t step, const PhysVal_t* values)
+{
+	buffer.push_back(step);
+	buffer.insert(buffer.end(), values, values + columns - 1);
+
+	if (buffer.size() == OBSERVATION_BUFFER_ROWS * columns) flush();
+}
+
+void ObservationFile::flush()
+{
+	if (buffer.empty()) return;
+
+	if (fwrite(buffer.data(), sizeof(PhysVal_t), buffer.size(), file) != buffer.size() || fflush(file) != 0)
+	{
+		printf("ObservationFile::flush(): Unable to write observations\n");
+		exit(1);
+	}
+
+	buffer.clear();
+}
+
+//==============================================
+// HISTOGRAM
+//==============================================
+
+HistogramObserver::HistogramObserver(unsigned newAxis, PhysVal_t newSize, size_t newBinCount, const char* path) :
+	axis     (newAxis),
+	size     (newSize),
+	binCount (newBinCount),
+	counts   (TYPES_COUNT * newBinCount, 0.0),
+	output   (nullptr)
+{
+	if (axis > 2 || size <= 0.0 || binCount == 0)
+	{
+		printf("HistogramObserver::ctor(): Expected an axis of 0, 1 or 2 and bins of positive size\n");
+		exit(1);
+	}
+
+	if (path) output = new ObservationFile(path, 1 + counts.size());
+}
+
+HistogramObserver::~HistogramObserver()
+{
+	delete output;
+}
+
+size_t HistogramObserver::sumCount() const
+{
+	return counts.size();
+}
+
+void HistogramObserver::reduce(const Molecule* mols, size_t count, PhysVal_t* sums) const
+{
+	PhysVal_t binsPerUnit = binCount / size;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const Vector& coords = mols[i].coords;
+		PhysVal_t coord = (axis == 0)? coords.x : (axis == 1)? coords.y : coords.z;
+
+		PhysVal_t bin = std::floor(coord * binsPerUnit);
+		size_t binI = (bin < 0.0)? 0 : (bin >= binCount)? binCount - 1 : static_cast<size_t>(bin);
+
+		sums[mols[i].type * binCount + binI] += 1.0;
+	}
+}
+
+void HistogramObserver::observe(const GasModel& model, const PhysVal_t* sums)
+{
+	counts.assign(sums, sums + counts.size());
+
+	if (output) output->writeRow(model.iteration, counts.data());
+}
+
+//==============================================
+// SPECIES COUNT
+//==============================================
+
+SpeciesCountObserver::SpeciesCountObserver(const char* path) :
+	counts (TYPES_COUNT, 0.0),
+	output (path? new ObservationFile(path, 1 + TYPES_COUNT) : nullptr)
+{}
+
+SpeciesCountObserver::~SpeciesCountObserver()
+{
+	delete output;
+}
+
+size_t SpeciesCountObserver::sumCount() const
+{
+	return TYPES_COUNT;
+}
+
+void SpeciesCountObserver::reduce(const Molecule* mols, size_t count, PhysVal_t* sums) const
+{
+	for (size_t i = 0; i < count; ++i)
+		sums[mols[i].type] += 1.0;
+}
+
+void SpeciesCountObserver::observe(const GasModel& model, const PhysVal_t* sums)
+{
+	counts.assign(sums, sums + TYPES_COUNT);
+
+	if (output) output->writeRow(model.iteration, counts.data());
+}
+
+//==============================================
+// ENERGY
+//==============================================
+
+// Columns are the kinetic and the potential energy
+EnergyObserver::EnergyObserver(const char* path) :
+	kineticEnergy   (0.0),
+	potentialEnergy (0.0),
+	output          (path? new ObservationFile(path, 3) : nullptr)
+{}
+
+EnergyObserver::~EnergyObserver()
+{
+	delete output;
+}
+
+size_t EnergyObserver::sumCount() const
+{
+	return 2;
+}
+
+void EnergyObserver::reduce(const Molecule* mols, size_t count, PhysVal_t* sums) const
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		sums[0] += MASSES[mols[i].type] * mols[i].speed.lenSqr();
+		sums[1] += MASSES[mols[i].type] * GRAVITY * mols[i].coords.z;
+	}
+}
+
+// Only attracting gases feel gravity
+void EnergyObserver::observe(const GasModel& model, const PhysVal_t* sums)
+{
+	kineticEnergy   = sums[0];
+	potentialEnergy = model.currPotentialEnergy + ((model.gasType == POTENTIAL_GAS)? sums[1] : 0.0);
+
+	PhysVal_t row[2] = {kineticEnergy, potentialEnergy};
+	if (output) output->writeRow(model.iteration, row);
+}
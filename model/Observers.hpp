@@ -0,0 +1,158 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef GAS_MODEL_OBSERVERS_HPP_INCLUDED
+#define GAS_MODEL_OBSERVERS_HPP_INCLUDED
+
+#include "Molecule.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+class GasModel;
+
+//==============================================
+// OBSERVERS
+//==============================================
+// Observers reduce the molecules to sums while
+// the sweep of a step goes over them anyway.
+// Every chunk of own molecules is handed to
+// reduce() on a pool thread, with the sums of
+// the chunk zeroed. Sums of the chunks are added
+// in chunk order, so they do not depend on the
+// thread count, and observe() gets them at the
+// end of the step, on the thread running it.
+// Molecules are seen as the sweep leaves them,
+// the potential of the step is found for these
+// same positions.
+//==============================================
+
+class Observer
+{
+public:
+	virtual ~Observer() = default;
+
+	// Sums are PhysVal_t, as many as the observer asks for:
+	virtual size_t sumCount() const = 0;
+	virtual void reduce(const Molecule* mols, size_t count, PhysVal_t* sums) const = 0;
+	virtual void observe(const GasModel& model, const PhysVal_t* sums) = 0;
+};
+
+// Observer of a model and how often it is called
+struct ObserverCadence
+{
+	Observer* observer;
+	size_t every;
+
+	// Where its sums start among the sums of a chunk, while the step it is due at goes:
+	size_t firstSum;
+	bool due;
+};
+
+//==============================================
+// OBSERVATION FILES
+//==============================================
+// [header                                       ]
+// [rows of columns PhysVal_t, the step first    ]
+//
+// Rows are the same size, so the file reads in
+// numpy as float64 from offset 16 reshaped to
+// (-1, columns).
+//==============================================
+
+const char     OBSERVATION_MAGIC[8]    = "GASOBS";
+const uint32_t OBSERVATION_VERSION     = 1;
+const size_t   OBSERVATION_BUFFER_ROWS = 4096;
+
+struct ObservationHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t columns;
+};
+
+// Rows are kept in memory and written a buffer at a time, each buffer goes to the file at once
+class ObservationFile
+{
+public:
+	// Columns count the step too
+	ObservationFile(const char* path, size_t newColumns);
+	// Writes the rows left in the buffer
+	~ObservationFile();
+
+	// Takes the columns after the step
+	void writeRow(size_t step, const PhysVal_t* values);
+	void flush();
+
+private:
+	FILE* file;
+	size_t columns;
+	std::vector<PhysVal_t> buffer;
+};
+
+//==============================================
+// REDUCERS
+//==============================================
+// Each keeps its last observation and writes it
+// to a file, if given one. Rows are tagged with
+// the iteration the step ends at.
+//==============================================
+
+// Molecules of every type in every bin along an axis, all bins of a type one after another.
+// Molecules outside of [0, size) are counted in the bin at the edge.
+class HistogramObserver : public Observer
+{
+public:
+	HistogramObserver(unsigned newAxis, PhysVal_t newSize, size_t newBinCount, const char* path = nullptr);
+	~HistogramObserver();
+
+	size_t sumCount() const override;
+	void reduce(const Molecule* mols, size_t count, PhysVal_t* sums) const override;
+	void observe(const GasModel& model, const PhysVal_t* sums) override;
+
+	unsigned axis;
+	PhysVal_t size;
+	size_t binCount;
+
+	std::vector<PhysVal_t> counts;
+
+private:
+	ObservationFile* output;
+};
+
+// Molecules of every type
+class SpeciesCountObserver : public Observer
+{
+public:
+	SpeciesCountObserver(const char* path = nullptr);
+	~SpeciesCountObserver();
+
+	size_t sumCount() const override;
+	void reduce(const Molecule* mols, size_t count, PhysVal_t* sums) const override;
+	void observe(const GasModel& model, const PhysVal_t* sums) override;
+
+	std::vector<PhysVal_t> counts;
+
+private:
+	ObservationFile* output;
+};
+
+// Energies the way GasModel::measureEnergy() finds them, gravity is left out for gases it does not act on
+class EnergyObserver : public Observer
+{
+public:
+	EnergyObserver(const char* path = nullptr);
+	~EnergyObserver();
+
+	size_t sumCount() const override;
+	void reduce(const Molecule* mols, size_t count, PhysVal_t* sums) const override;
+	void observe(const GasModel& model, const PhysVal_t* sums) override;
+
+	PhysVal_t kineticEnergy;
+	PhysVal_t potentialEnergy;
+
+private:
+	ObservationFile* output;
+};
+
+#endif // GAS_MODEL_OBSERVERS_HPP_INCLUDED
\ No newline at end of file
@@ -3,43 +3,356 @@
 
 #include "vendor/cnpy/cnpy.h"
 
-const unsigned PRE_BUFFER_FACTOR = 10;
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <zlib.h>
 
-DataSaver::DataSaver(size_t count) :
-	coords        (new PhysVal_t[PRE_BUFFER_FACTOR * 3 * count]),
-	velocities    (new PhysVal_t[PRE_BUFFER_FACTOR *     count]),
-	moleculeCount (count),
-	preBufferred  (0)
-{}
+// Huffman coding alone, the planes have few repeated strings for the match search to find
+inline bool deflatePlanes(const std::vector<uint8_t>& planes, std::vector<uint8_t>& packed, uLongf& packedBytes)
+{
+	z_stream deflater = {};
+	if (deflateInit2(&deflater, Z_BEST_SPEED, Z_DEFLATED, 15, 8, Z_HUFFMAN_ONLY) != Z_OK) return false;
+
+	packed.resize(deflateBound(&deflater, planes.size()));
+
+	deflater.next_in   = const_cast<Bytef*>(planes.data());
+	deflater.avail_in  = planes.size();
+	deflater.next_out  = packed.data();
+	deflater.avail_out = packed.size();
+
+	bool done = deflate(&deflater, Z_FINISH) == Z_STREAM_END;
+	packedBytes = deflater.total_out;
+
+	deflateEnd(&deflater);
+	return done;
+}
+
+DataSaver::DataSaver(size_t count, size_t newQueueDepth, FrameOverflow newOverflow) :
+	coords               (new PhysVal_t[newQueueDepth * 3 * count]),
+	velocities           (new PhysVal_t[newQueueDepth *     count]),
+	coordsFiles          (newQueueDepth),
+	velocitiesFiles      (newQueueDepth),
+	moleculeCount        (count),
+	queueDepth           (newQueueDepth),
+	overflow             (newOverflow),
+	mutex                (),
+	frameQueued          (),
+	frameSaved           (),
+	firstQueued          (0),
+	queuedCount          (0),
+	stopping             (false),
+	writer               (),
+	encoding             (RAW_FRAMES),
+	quantizationBits     (DEFAULT_QUANTIZATION_BITS),
+	keyframeInterval     (DEFAULT_KEYFRAME_INTERVAL),
+	boxSizes             (newQueueDepth, Vector(0, 0, 0)),
+	streamCoordsFile     (),
+	streamVelocitiesFile (),
+	coordsStream         (nullptr),
+	velocitiesStream     (nullptr),
+	framesSinceKeyframe  (0),
+	speedScale           (0.0),
+	prevCoords           (3 * count),
+	prevSpeeds           (count),
+	planes               (),
+	packed               (),
+	droppedFrames        (0)
+{
+	if (queueDepth == 0)
+	{
+		printf("DataSaver::ctor(): Frames need at least one queue slot\n");
+		exit(1);
+	}
+
+	writer = std::thread(&DataSaver::writerLoop, this);
+}
 
 DataSaver::~DataSaver()
 {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+
+	frameQueued.notify_one();
+	writer.join();
+
+	closeStreams();
+
 	delete[] coords;
 	delete[] velocities; 
 }
 
+//==============================================
+// SIMULATION SIDE
+//==============================================
+
 void DataSaver::writeFrame(const GasModel& model, const char* coordsFile, const char* velocitiesFile)
 {
+	size_t slot = 0;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		if (queuedCount == queueDepth && overflow == DROP_FRAMES)
+		{
+			++droppedFrames;
+			return;
+		}
+
+		frameSaved.wait(lock, [this]() { return queuedCount < queueDepth; });
+
+		slot = (firstQueued + queuedCount) % queueDepth;
+	}
+
+	// The writer never touches slots outside the queue, so the copy goes without the lock:
+	PhysVal_t* slotCoords     = coords     + 3 * slot * moleculeCount;
+	PhysVal_t* slotVelocities = velocities +     slot * moleculeCount;
+
 	for (size_t i = 0; i < moleculeCount; ++i)
 	{
-		coords[3 * (preBufferred * moleculeCount + i) + 0] = model.molecules[i].coords.x;
-		coords[3 * (preBufferred * moleculeCount + i) + 1] = model.molecules[i].coords.y;
-		coords[3 * (preBufferred * moleculeCount + i) + 2] = model.molecules[i].coords.z;
-		
-		velocities[preBufferred * moleculeCount + i] = model.molecules[i].speed.length();
+		slotCoords[3 * i + 0] = model.molecules[i].coords.x;
+		slotCoords[3 * i + 1] = model.molecules[i].coords.y;
+		slotCoords[3 * i + 2] = model.molecules[i].coords.z;
+
+		slotVelocities[i] = model.molecules[i].speed.length() * model.pendingSpeedScale;
+	}
+
+	coordsFiles    [slot] = coordsFile;
+	velocitiesFiles[slot] = velocitiesFile;
+	boxSizes       [slot] = model.box.containerSize;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		++queuedCount;
+	}
+
+	frameQueued.notify_one();
+}
+
+void DataSaver::flush()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	frameSaved.wait(lock, [this]() { return queuedCount == 0; });
+}
+
+//==============================================
+// WRITER THREAD
+//==============================================
+
+// Queued frames stay in the queue while they are saved, so writeFrame() never reuses their slots
+void DataSaver::writerLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		frameQueued.wait(lock, [this]() { return queuedCount != 0 || stopping; });
+		if (queuedCount == 0) return;
+
+		// Frames up to the end of the ring that go to the same files are contiguous:
+		size_t first = firstQueued;
+		size_t count = 1;
+		while (count < queuedCount && first + count < queueDepth &&
+		       coordsFiles    [first + count] == coordsFiles    [first] &&
+		       velocitiesFiles[first + count] == velocitiesFiles[first])
+		{
+			++count;
+		}
+
+		FrameEncoding batchEncoding = encoding;
+
+		lock.unlock();
+
+		if (batchEncoding == RAW_FRAMES)
+		{
+			cnpy::npy_save(coordsFiles[first],     coords     + 3 * first * moleculeCount, {count, moleculeCount, 3}, "a");
+			cnpy::npy_save(velocitiesFiles[first], velocities +     first * moleculeCount, {count, moleculeCount   }, "a");
+		}
+		else
+		{
+			for (size_t slot = first; slot < first + count; ++slot)
+				saveCompressed(slot);
+
+			// Saved frames are in the files once flush() returns:
+			if (fflush(coordsStream) != 0 || fflush(velocitiesStream) != 0)
+			{
+				printf("DataSaver::writerLoop(): Unable to save frames\n");
+				exit(1);
+			}
+		}
+
+		lock.lock();
+
+		firstQueued  = (first + count) % queueDepth;
+		queuedCount -= count;
+
+		frameSaved.notify_all();
+	}
+}
+
+//==============================================
+// COMPRESSION
+//==============================================
+
+void DataSaver::setEncoding(FrameEncoding newEncoding, unsigned bits, size_t newKeyframeInterval)
+{
+	if (bits == 0 || bits > 16 || newKeyframeInterval == 0)
+	{
+		printf("DataSaver::setEncoding(): Bits go from 1 to 16, keyframes need a positive interval\n");
+		exit(1);
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	frameSaved.wait(lock, [this]() { return queuedCount == 0; });
+
+	encoding         = newEncoding;
+	quantizationBits = bits;
+	keyframeInterval = newKeyframeInterval;
+
+	// The next frame starts the streams anew:
+	closeStreams();
+}
+
+// Frames are appended to a stream saved before only if it has the same layout
+FILE* DataSaver::openStream(const std::string& file, size_t components)
+{
+	FILE* stream = fopen(file.c_str(), "a+b");
+	if (stream == nullptr)
+	{
+		printf("DataSaver::openStream(): Unable to open file \'%s\'\n", file.c_str());
+		exit(1);
+	}
+
+	QuantizedStreamHeader header;
+	memcpy(header.magic, QUANTIZED_STREAM_MAGIC, sizeof(QUANTIZED_STREAM_MAGIC));
+	header.version       = QUANTIZED_STREAM_VERSION;
+	header.bits          = quantizationBits;
+	header.moleculeCount = moleculeCount;
+	header.components    = components;
+
+	fseek(stream, 0, SEEK_END);
+	if (ftell(stream) == 0)
+	{
+		fwrite(&header, sizeof(header), 1, stream);
+		return stream;
+	}
+
+	QuantizedStreamHeader saved;
+	fseek(stream, 0, SEEK_SET);
+	if (fread(&saved, sizeof(saved), 1, stream) != 1 || memcmp(&saved, &header, sizeof(header)) != 0)
+	{
+		printf("DataSaver::openStream(): File \'%s\' holds other frames, remove it first\n", file.c_str());
+		exit(1);
 	}
 
-	preBufferred++;
+	return stream;
+}
+
+void DataSaver::closeStreams()
+{
+	if (coordsStream)     fclose(coordsStream);
+	if (velocitiesStream) fclose(velocitiesStream);
 
-	if (preBufferred == PRE_BUFFER_FACTOR)
+	coordsStream     = nullptr;
+	velocitiesStream = nullptr;
+
+	streamCoordsFile    .clear();
+	streamVelocitiesFile.clear();
+}
+
+void DataSaver::appendFrame(FILE* stream, const PhysVal_t* values, size_t components, const PhysVal_t* scales,
+                            std::vector<uint16_t>& prev, bool keyframe)
+{
+	PhysVal_t top = (1u << quantizationBits) - 1;
+
+	planes.resize(2 * components * moleculeCount);
+	for (size_t comp = 0; comp < components; ++comp)
 	{
-		preBufferred = 0;
+		PhysVal_t toQuanta = (scales[comp] > 0.0)? top / scales[comp] : 0.0;
+
+		uint8_t* lowBytes  = planes.data() + (2 * comp    ) * moleculeCount;
+		uint8_t* highBytes = planes.data() + (2 * comp + 1) * moleculeCount;
+		uint16_t* prevComp = prev.data() + comp * moleculeCount;
 
-		cnpy::npy_save(    coordsFile,     coords, {PRE_BUFFER_FACTOR, moleculeCount, 3}, "a");
-		cnpy::npy_save(velocitiesFile, velocities, {PRE_BUFFER_FACTOR, moleculeCount   }, "a");
+		for (size_t i = 0; i < moleculeCount; ++i)
+		{
+			PhysVal_t quanta = std::round(values[components * i + comp] * toQuanta);
+			uint16_t value = static_cast<uint16_t>((quanta < 0.0)? 0.0 : (quanta > top)? top : quanta);
+
+			uint16_t code = value;
+			if (!keyframe)
+			{
+				int16_t step = static_cast<int16_t>(static_cast<uint16_t>(value - prevComp[i]));
+				code = static_cast<uint16_t>(static_cast<uint16_t>(step) << 1) ^ static_cast<uint16_t>(step >> 15);
+			}
+
+			prevComp[i] = value;
+
+			lowBytes [i] = code & 0xFF;
+			highBytes[i] = code >> 8;
+		}
+	}
+
+	uLongf packedBytes = 0;
+	if (!deflatePlanes(planes, packed, packedBytes))
+	{
+		printf("DataSaver::appendFrame(): Unable to compress a frame\n");
+		exit(1);
+	}
+
+	QuantizedFrameHeader header = {keyframe, static_cast<uint32_t>(packedBytes), {0.0, 0.0, 0.0}};
+	for (size_t comp = 0; comp < components; ++comp)
+		header.scales[comp] = scales[comp];
+
+	if (fwrite(&header, sizeof(header), 1, stream) != 1 || fwrite(packed.data(), 1, packedBytes, stream) != packedBytes)
+	{
+		printf("DataSaver::appendFrame(): Unable to save a frame\n");
+		exit(1);
 	}
 }
 
+// Speeds keep the scale of their keyframe, so that steps between frames are in the same quanta
+void DataSaver::saveCompressed(size_t slot)
+{
+	bool sameFiles = coordsStream != nullptr &&
+	                 coordsFiles[slot] == streamCoordsFile && velocitiesFiles[slot] == streamVelocitiesFile;
+	if (!sameFiles)
+	{
+		closeStreams();
+
+		coordsStream     = openStream(coordsFiles    [slot], 3);
+		velocitiesStream = openStream(velocitiesFiles[slot], 1);
+
+		streamCoordsFile     = coordsFiles    [slot];
+		streamVelocitiesFile = velocitiesFiles[slot];
+	}
+
+	const PhysVal_t* slotCoords     = coords     + 3 * slot * moleculeCount;
+	const PhysVal_t* slotVelocities = velocities +     slot * moleculeCount;
+
+	PhysVal_t boxScales[3] = {boxSizes[slot].x, boxSizes[slot].y, boxSizes[slot].z};
+
+	PhysVal_t topSpeed = 0.0;
+	for (size_t i = 0; i < moleculeCount; ++i)
+		topSpeed = std::max(topSpeed, slotVelocities[i]);
+
+	// A frame faster than the scale starts a keyframe of its own, so speeds are never clamped:
+	bool keyframe = !sameFiles || framesSinceKeyframe == keyframeInterval || topSpeed > speedScale;
+	if (keyframe) speedScale = KEYFRAME_SPEED_HEADROOM * topSpeed;
+
+	appendFrame(coordsStream,     slotCoords,     3, boxScales,   prevCoords, keyframe);
+	appendFrame(velocitiesStream, slotVelocities, 1, &speedScale, prevSpeeds, keyframe);
+
+	framesSinceKeyframe = keyframe? 1 : framesSinceKeyframe + 1;
+}
+
+//==============================================
+// MOLECULE TYPES
+//==============================================
+
 void DataSaver::writeMoleculeTypes(const GasModel& model, const char* typesFile)
 {
 	char* moleculeTypes = new char[moleculeCount];
@@ -51,3 +364,92 @@ void DataSaver::writeMoleculeTypes(const GasModel& model, const char* typesFile)
 
 	cnpy::npy_save(typesFile, moleculeTypes, {moleculeCount}, "w");  
 }
+
+//==============================================
+// DECODING
+//==============================================
+
+QuantizedFrameReader::QuantizedFrameReader(const char* path) :
+	stream (fopen(path, "rb")),
+	header (),
+	prev   (),
+	planes (),
+	packed ()
+{
+	if (stream == nullptr)
+	{
+		printf("QuantizedFrameReader::ctor(): Unable to open file \'%s\'\n", path);
+		exit(1);
+	}
+
+	if (fread(&header, sizeof(header), 1, stream) != 1 ||
+	    memcmp(header.magic, QUANTIZED_STREAM_MAGIC, sizeof(QUANTIZED_STREAM_MAGIC)) != 0 ||
+	    header.version != QUANTIZED_STREAM_VERSION || header.components == 0 || header.components > 3)
+	{
+		printf("QuantizedFrameReader::ctor(): File \'%s\' is not a version %u frame stream\n", path,
+		       QUANTIZED_STREAM_VERSION);
+		exit(1);
+	}
+
+	prev  .assign(header.components * header.moleculeCount, 0);
+	planes.resize(2 * header.components * header.moleculeCount);
+}
+
+QuantizedFrameReader::~QuantizedFrameReader()
+{
+	fclose(stream);
+}
+
+size_t QuantizedFrameReader::moleculeCount() const
+{
+	return header.moleculeCount;
+}
+
+size_t QuantizedFrameReader::components() const
+{
+	return header.components;
+}
+
+bool QuantizedFrameReader::readFrame(PhysVal_t* values)
+{
+	QuantizedFrameHeader frame;
+	if (fread(&frame, sizeof(frame), 1, stream) != 1) return false;
+
+	packed.resize(frame.packedBytes);
+	uLongf planesBytes = planes.size();
+
+	if (fread(packed.data(), 1, frame.packedBytes, stream) != frame.packedBytes ||
+	    uncompress(planes.data(), &planesBytes, packed.data(), frame.packedBytes) != Z_OK ||
+	    planesBytes != planes.size())
+	{
+		printf("QuantizedFrameReader::readFrame(): The stream is cut or broken\n");
+		exit(1);
+	}
+
+	size_t count = header.moleculeCount;
+	PhysVal_t top = (1u << header.bits) - 1;
+
+	for (size_t comp = 0; comp < header.components; ++comp)
+	{
+		const uint8_t* lowBytes  = planes.data() + (2 * comp    ) * count;
+		const uint8_t* highBytes = planes.data() + (2 * comp + 1) * count;
+		uint16_t* prevComp = prev.data() + comp * count;
+
+		PhysVal_t fromQuanta = frame.scales[comp] / top;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			uint16_t code = lowBytes[i] | (highBytes[i] << 8);
+
+			uint16_t value = code;
+			if (!frame.keyframe)
+				value = prevComp[i] + ((code >> 1) ^ static_cast<uint16_t>(-(code & 1)));
+
+			prevComp[i] = value;
+
+			values[header.components * i + comp] = value * fromQuanta;
+		}
+	}
+
+	return true;
+}
@@ -4,20 +4,164 @@
 
 #include "Model.hpp"
 
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What writeFrame() does when all queue slots wait for the writer
+enum FrameOverflow
+{
+	WAIT_FOR_WRITER = 0,
+	DROP_FRAMES     = 1
+};
+
+const size_t DEFAULT_FRAME_QUEUE_DEPTH = 32;
+
+// How the writer thread stores frames
+enum FrameEncoding
+{
+	RAW_FRAMES        = 0,
+	COMPRESSED_FRAMES = 1
+};
+
+const unsigned  DEFAULT_QUANTIZATION_BITS = 16;
+const size_t    DEFAULT_KEYFRAME_INTERVAL = 32;
+const PhysVal_t KEYFRAME_SPEED_HEADROOM   = 1.5;
+
+//==============================================
+// COMPRESSED FRAMES
+//==============================================
+// Every file is a stream header and then frames,
+// each a frame header and a zlib-packed payload.
+// Values are quantized to bits-bit integers q,
+// value = q / (2^bits - 1) * scale, coordinates
+// against the box size, speeds against the top
+// speed at the last keyframe with some headroom,
+// so that steps of a speed are in one scale. A
+// frame faster than that is a keyframe itself.
+// Coordinates outside the box are clamped to it.
+// Every frame header repeats the scales of its
+// keyframe. Keyframes store q, other
+// frames the difference from the previous frame
+// modulo 2^16, zigzag-coded so that small steps
+// either way are small numbers. The payload goes
+// component by component, every component as a
+// plane of low bytes and a plane of high bytes.
+//==============================================
+
+const char     QUANTIZED_STREAM_MAGIC[8] = "GASQNT";
+const uint32_t QUANTIZED_STREAM_VERSION  = 1;
+
+struct QuantizedStreamHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t bits;
+	uint64_t moleculeCount;
+	// 3 for coordinates, 1 for speeds:
+	uint64_t components;
+};
+
+struct QuantizedFrameHeader
+{
+	uint32_t keyframe;
+	uint32_t packedBytes;
+	PhysVal_t scales[3];
+};
+
+// Frames are copied into a ring of queueDepth slots and saved by a writer thread,
+// every run of queued frames for the same files in a single append.
 class DataSaver
 {
 private:
 	PhysVal_t* coords;
 	PhysVal_t* velocities;
+	std::vector<std::string> coordsFiles;
+	std::vector<std::string> velocitiesFiles;
 	size_t moleculeCount;
-	size_t preBufferred;
+	size_t queueDepth;
+	FrameOverflow overflow;
+
+	// Slots [firstQueued, firstQueued + queuedCount) modulo the depth, the ones being saved included:
+	std::mutex mutex;
+	std::condition_variable frameQueued;
+	std::condition_variable frameSaved;
+	size_t firstQueued;
+	size_t queuedCount;
+	bool stopping;
+
+	std::thread writer;
+
+	// Changed under the lock while nothing is queued:
+	FrameEncoding encoding;
+	unsigned quantizationBits;
+	size_t keyframeInterval;
+
+	// Box size of every slot, coordinates are quantized against it:
+	std::vector<Vector> boxSizes;
+
+	// Compressed streams, only ever touched by the writer thread. They stay open while frames go to the same files:
+	std::string streamCoordsFile;
+	std::string streamVelocitiesFile;
+	FILE* coordsStream;
+	FILE* velocitiesStream;
+	size_t framesSinceKeyframe;
+	PhysVal_t speedScale;
+	std::vector<uint16_t> prevCoords;
+	std::vector<uint16_t> prevSpeeds;
+	std::vector<uint8_t> planes;
+	std::vector<uint8_t> packed;
+
+	void writerLoop();
+
+	FILE* openStream(const std::string& file, size_t components);
+	void closeStreams();
+	void saveCompressed(size_t slot);
+	void appendFrame(FILE* stream, const PhysVal_t* values, size_t components, const PhysVal_t* scales,
+	                 std::vector<uint16_t>& prev, bool keyframe);
 
 public:
-	DataSaver(size_t count);
+	DataSaver(size_t count, size_t newQueueDepth = DEFAULT_FRAME_QUEUE_DEPTH, FrameOverflow newOverflow = WAIT_FOR_WRITER);
+	// Saves all queued frames first
 	~DataSaver();
 
 	void writeFrame(const GasModel& model, const char* coordsFile, const char* velocitiesFile);
 	void writeMoleculeTypes(const GasModel& model, const char* typesFile);
+
+	// Saves the queued frames first, the ones after the call are stored the new way. Bits go up to 16.
+	void setEncoding(FrameEncoding newEncoding, unsigned bits = DEFAULT_QUANTIZATION_BITS,
+	                 size_t newKeyframeInterval = DEFAULT_KEYFRAME_INTERVAL);
+
+	// Waits until every queued frame is saved
+	void flush();
+
+	size_t droppedFrames;
+};
+
+// Decodes the frames of a COMPRESSED_FRAMES file one after another
+class QuantizedFrameReader
+{
+private:
+	FILE* stream;
+	QuantizedStreamHeader header;
+	std::vector<uint16_t> prev;
+	std::vector<uint8_t> planes;
+	std::vector<uint8_t> packed;
+
+public:
+	QuantizedFrameReader(const char* path);
+	~QuantizedFrameReader();
+
+	size_t moleculeCount() const;
+	size_t components() const;
+
+	// Values go in the order of raw frames, components of a molecule together.
+	// False once the stream is over.
+	bool readFrame(PhysVal_t* values);
 };
 
 #endif // GAS_MODEL_SAVING_TO_FILE_HPP_INCLUDED
\ No newline at end of file
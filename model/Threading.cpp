@@ -0,0 +1,92 @@
+// No Copyright. Vladislav Aleinik 2019
+#include "Threading.hpp"
+
+ThreadPool::ThreadPool(size_t threadCount) :
+	workers          (),
+	mutex            (),
+	wakeUp           (),
+	allDone          (),
+	currentTask      (nullptr),
+	currentTaskCount (0),
+	nextTask         (0),
+	busyWorkers      (0),
+	generation       (0),
+	stopping         (false)
+{
+	// The calling thread always works as thread 0
+	for (size_t threadI = 1; threadI < threadCount; ++threadI)
+		workers.emplace_back(&ThreadPool::workerLoop, this, threadI);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+size_t ThreadPool::size() const
+{
+	return workers.size() + 1;
+}
+
+void ThreadPool::parallelFor(size_t taskCount, const Task& task)
+{
+	if (workers.empty() || taskCount <= 1)
+	{
+		for (size_t taskI = 0; taskI < taskCount; ++taskI)
+			task(taskI, 0);
+
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		currentTask      = &task;
+		currentTaskCount = taskCount;
+		nextTask         = 0;
+		busyWorkers      = workers.size();
+		++generation;
+	}
+	wakeUp.notify_all();
+
+	runTasks(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	allDone.wait(lock, [this]{ return busyWorkers == 0; });
+	currentTask = nullptr;
+}
+
+void ThreadPool::workerLoop(size_t threadI)
+{
+	size_t seenGeneration = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeUp.wait(lock, [this, seenGeneration]{ return stopping || generation != seenGeneration; });
+			if (stopping) return;
+
+			seenGeneration = generation;
+		}
+
+		runTasks(threadI);
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (--busyWorkers == 0) allDone.notify_one();
+		}
+	}
+}
+
+void ThreadPool::runTasks(size_t threadI)
+{
+	for (size_t taskI = nextTask++; taskI < currentTaskCount; taskI = nextTask++)
+		(*currentTask)(taskI, threadI);
+}
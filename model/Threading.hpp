@@ -0,0 +1,46 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef GAS_MODEL_THREADING_HPP_INCLUDED
+#define GAS_MODEL_THREADING_HPP_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads reused by every parallel pass of the model
+class ThreadPool
+{
+public:
+	using Task = std::function<void(size_t taskI, size_t threadI)>;
+
+	ThreadPool(size_t threadCount);
+	~ThreadPool();
+
+	size_t size() const;
+
+	// Runs task(taskI, threadI) for every taskI in [0, taskCount) and waits for all of them.
+	// Tasks are handed out dynamically, threadI is in [0, size()) and is unique among running tasks.
+	void parallelFor(size_t taskCount, const Task& task);
+
+private:
+	void workerLoop(size_t threadI);
+	void runTasks(size_t threadI);
+
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::condition_variable allDone;
+
+	const Task* currentTask;
+	size_t currentTaskCount;
+	std::atomic<size_t> nextTask;
+	size_t busyWorkers;
+	size_t generation;
+	bool stopping;
+};
+
+#endif  // GAS_MODEL_THREADING_HPP_INCLUDED
@@ -0,0 +1,357 @@
+// No Copyright. Vladislav Aleinik 2019
+#include "Trajectory.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+inline uint64_t roundUpToPage(uint64_t bytes)
+{
+	return (bytes + TRAJECTORY_PAGE_SIZE - 1) / TRAJECTORY_PAGE_SIZE * TRAJECTORY_PAGE_SIZE;
+}
+
+//==============================================
+// WRITER
+//==============================================
+
+TrajectoryWriter::TrajectoryWriter(const char* path, const GasModel& model, size_t capacity,
+                                   TrajectoryOpening opening) :
+	fd            (-1),
+	moleculeCount (model.moleculeCount - model.ghostCount),
+	head          (nullptr),
+	headBytes     (0),
+	header        (nullptr),
+	index         (nullptr),
+	chunk         (nullptr),
+	chunkBytes    (0),
+	chunkFrames   (nullptr),
+	chunkFirst    (0)
+{
+	if (moleculeCount == 0 || capacity == 0)
+	{
+		printf("TrajectoryWriter::ctor(): Nothing to save, add molecules first\n");
+		exit(1);
+	}
+
+	if (opening == RESUME_TRAJECTORY && resumeFile(path, model)) return;
+
+	createFile(path, model, capacity);
+}
+
+void TrajectoryWriter::mapHead(const char* path)
+{
+	void* mapping = mmap(nullptr, headBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED)
+	{
+		printf("TrajectoryWriter::mapHead(): Unable to map file \'%s\'\n", path);
+		exit(1);
+	}
+
+	head   = static_cast<char*>(mapping);
+	header = reinterpret_cast<TrajectoryHeader*>(head);
+}
+
+void TrajectoryWriter::createFile(const char* path, const GasModel& model, size_t capacity)
+{
+	uint64_t typesOffset = TRAJECTORY_PAGE_SIZE;
+	uint64_t indexOffset = roundUpToPage(typesOffset + moleculeCount);
+	uint64_t dataOffset  = roundUpToPage(indexOffset + capacity * sizeof(TrajectoryIndexEntry));
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+	{
+		printf("TrajectoryWriter::createFile(): Unable to open file \'%s\'\n", path);
+		exit(1);
+	}
+
+	// Pages of the index past the frames written are never touched, so they take no disk space:
+	headBytes = dataOffset;
+	if (ftruncate(fd, headBytes) == -1)
+	{
+		printf("TrajectoryWriter::createFile(): Unable to resize file \'%s\'\n", path);
+		exit(1);
+	}
+
+	mapHead(path);
+	index = reinterpret_cast<TrajectoryIndexEntry*>(head + indexOffset);
+
+	memcpy(header->magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC));
+	header->version       = TRAJECTORY_VERSION;
+	header->headerBytes   = TRAJECTORY_PAGE_SIZE;
+	header->moleculeCount = moleculeCount;
+	header->frameBytes    = 4 * moleculeCount * sizeof(PhysVal_t);
+	header->frameCapacity = capacity;
+	header->frameCount    = 0;
+	header->typesOffset   = typesOffset;
+	header->indexOffset   = indexOffset;
+	header->dataOffset    = dataOffset;
+	header->boxSize[0]    = model.box.containerSize.x;
+	header->boxSize[1]    = model.box.containerSize.y;
+	header->boxSize[2]    = model.box.containerSize.z;
+
+	uint8_t* types = reinterpret_cast<uint8_t*>(head + typesOffset);
+	for (size_t i = 0; i < moleculeCount; ++i)
+		types[i] = model.molecules[i].type;
+
+	mapChunk(0);
+}
+
+// Frames from the model's iteration on are left over from a run after the checkpoint, so they are written anew
+bool TrajectoryWriter::resumeFile(const char* path, const GasModel& model)
+{
+	fd = open(path, O_RDWR);
+	if (fd == -1 && errno == ENOENT) return false;
+
+	TrajectoryHeader saved;
+	if (fd == -1 || pread(fd, &saved, sizeof(saved), 0) != sizeof(saved) ||
+	    memcmp(saved.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC)) != 0 || saved.version != TRAJECTORY_VERSION ||
+	    saved.moleculeCount != moleculeCount)
+	{
+		printf("TrajectoryWriter::resumeFile(): File \'%s\' is not a trajectory of this model\n", path);
+		exit(1);
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) == -1 || static_cast<uint64_t>(fileStat.st_size) < saved.dataOffset)
+	{
+		printf("TrajectoryWriter::resumeFile(): File \'%s\' is cut short\n", path);
+		exit(1);
+	}
+
+	headBytes = saved.dataOffset;
+	mapHead(path);
+	index = reinterpret_cast<TrajectoryIndexEntry*>(head + header->indexOffset);
+
+	size_t framesInFile = (fileStat.st_size - header->dataOffset) / header->frameBytes;
+	size_t kept = std::min<size_t>(header->frameCount, framesInFile);
+
+	while (kept != 0 && index[kept - 1].step >= model.iteration)
+		--kept;
+
+	header->frameCount = kept;
+	mapChunk(kept);
+
+	return true;
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+	unmapChunk();
+
+	uint64_t fileBytes = header->dataOffset + header->frameCount * header->frameBytes;
+
+	munmap(head, headBytes);
+
+	if (ftruncate(fd, fileBytes) == -1)
+		printf("TrajectoryWriter::dtor(): Unable to cut the file to its frames\n");
+
+	close(fd);
+}
+
+// Chunks start at any frame, so the mapping starts at the page the chunk begins in
+void TrajectoryWriter::mapChunk(size_t firstFrame)
+{
+	size_t frameCapacityLeft = header->frameCapacity - firstFrame;
+	size_t chunkFrameCount   = (frameCapacityLeft < TRAJECTORY_CHUNK_FRAMES)? frameCapacityLeft : TRAJECTORY_CHUNK_FRAMES;
+
+	// A full trajectory takes no more frames, writeFrame() tells so:
+	chunkFirst = firstFrame;
+	if (chunkFrameCount == 0) return;
+
+	uint64_t first   = header->dataOffset + firstFrame * header->frameBytes;
+	uint64_t last    = first + chunkFrameCount * header->frameBytes;
+	uint64_t mapFrom = first / TRAJECTORY_PAGE_SIZE * TRAJECTORY_PAGE_SIZE;
+
+	if (ftruncate(fd, last) == -1)
+	{
+		printf("TrajectoryWriter::mapChunk(): Unable to grow the file\n");
+		exit(1);
+	}
+
+	void* mapping = mmap(nullptr, last - mapFrom, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mapFrom);
+	if (mapping == MAP_FAILED)
+	{
+		printf("TrajectoryWriter::mapChunk(): Unable to map frames\n");
+		exit(1);
+	}
+
+	chunk       = static_cast<char*>(mapping);
+	chunkBytes  = last - mapFrom;
+	chunkFrames = chunk + (first - mapFrom);
+}
+
+void TrajectoryWriter::unmapChunk()
+{
+	if (chunk == nullptr) return;
+
+	munmap(chunk, chunkBytes);
+	chunk = nullptr;
+}
+
+void TrajectoryWriter::writeFrame(const GasModel& model)
+{
+	size_t frameI = header->frameCount;
+	if (frameI == header->frameCapacity)
+	{
+		printf("TrajectoryWriter::writeFrame(): All %zu frames are taken, make the trajectory bigger\n",
+		       static_cast<size_t>(header->frameCapacity));
+		exit(1);
+	}
+
+	if (model.moleculeCount - model.ghostCount != moleculeCount)
+	{
+		printf("TrajectoryWriter::writeFrame(): The molecule count has changed since the first frame\n");
+		exit(1);
+	}
+
+	if (frameI == chunkFirst + TRAJECTORY_CHUNK_FRAMES)
+	{
+		unmapChunk();
+		mapChunk(frameI);
+	}
+
+	PhysVal_t* coords = reinterpret_cast<PhysVal_t*>(chunkFrames + (frameI - chunkFirst) * header->frameBytes);
+	PhysVal_t* speeds = coords + 3 * moleculeCount;
+
+	for (size_t i = 0; i < moleculeCount; ++i)
+	{
+		coords[3 * i + 0] = model.molecules[i].coords.x;
+		coords[3 * i + 1] = model.molecules[i].coords.y;
+		coords[3 * i + 2] = model.molecules[i].coords.z;
+
+		speeds[i] = model.molecules[i].speed.length() * model.pendingSpeedScale;
+	}
+
+	index[frameI] = {model.iteration, header->dataOffset + frameI * header->frameBytes};
+
+	// A reader of the growing file sees the frame only once it is all there:
+	__atomic_store_n(&header->frameCount, frameI + 1, __ATOMIC_RELEASE);
+}
+
+size_t TrajectoryWriter::frameCount() const
+{
+	return header->frameCount;
+}
+
+//==============================================
+// READER
+//==============================================
+
+TrajectoryReader::TrajectoryReader(const char* path) :
+	fd        (-1),
+	data      (nullptr),
+	dataBytes (0),
+	header    (nullptr),
+	index     (nullptr),
+	frames    (0)
+{
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+	{
+		printf("TrajectoryReader::ctor(): Unable to open file \'%s\'\n", path);
+		exit(1);
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) == -1 || static_cast<size_t>(fileStat.st_size) < sizeof(TrajectoryHeader))
+	{
+		printf("TrajectoryReader::ctor(): File \'%s\' is too short for a trajectory\n", path);
+		exit(1);
+	}
+
+	dataBytes = fileStat.st_size;
+
+	void* mapping = mmap(nullptr, dataBytes, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED)
+	{
+		printf("TrajectoryReader::ctor(): Unable to map file \'%s\'\n", path);
+		exit(1);
+	}
+
+	data   = static_cast<char*>(mapping);
+	header = reinterpret_cast<const TrajectoryHeader*>(data);
+
+	if (memcmp(header->magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC)) != 0 ||
+	    header->version != TRAJECTORY_VERSION || header->dataOffset > dataBytes)
+	{
+		printf("TrajectoryReader::ctor(): File \'%s\' is not a version %u trajectory\n", path, TRAJECTORY_VERSION);
+		exit(1);
+	}
+
+	index = reinterpret_cast<const TrajectoryIndexEntry*>(data + header->indexOffset);
+
+	// A file still being written may be longer than its complete frames:
+	size_t completeFrames = __atomic_load_n(&header->frameCount, __ATOMIC_ACQUIRE);
+	size_t framesInFile   = (dataBytes - header->dataOffset) / header->frameBytes;
+
+	frames = (completeFrames < framesInFile)? completeFrames : framesInFile;
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+	munmap(data, dataBytes);
+	close(fd);
+}
+
+size_t TrajectoryReader::frameCount() const
+{
+	return frames;
+}
+
+size_t TrajectoryReader::moleculeCount() const
+{
+	return header->moleculeCount;
+}
+
+Vector TrajectoryReader::boxSize() const
+{
+	return Vector(header->boxSize[0], header->boxSize[1], header->boxSize[2]);
+}
+
+const uint8_t* TrajectoryReader::moleculeTypes() const
+{
+	return reinterpret_cast<const uint8_t*>(data + header->typesOffset);
+}
+
+uint64_t TrajectoryReader::frameStep(size_t frameI) const
+{
+	return index[frameI].step;
+}
+
+const PhysVal_t* TrajectoryReader::coords(size_t frameI) const
+{
+	return reinterpret_cast<const PhysVal_t*>(data + index[frameI].offset);
+}
+
+const PhysVal_t* TrajectoryReader::speeds(size_t frameI) const
+{
+	return coords(frameI) + 3 * header->moleculeCount;
+}
+
+size_t TrajectoryReader::frameBytes() const
+{
+	return header->frameBytes;
+}
+
+// Steps only grow along the file
+size_t TrajectoryReader::findFrame(uint64_t step) const
+{
+	size_t lo = 0;
+	size_t hi = frames;
+
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (index[mid].step < step) lo = mid + 1;
+		else                        hi = mid;
+	}
+
+	return lo;
+}
@@ -0,0 +1,133 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef GAS_MODEL_TRAJECTORY_HPP_INCLUDED
+#define GAS_MODEL_TRAJECTORY_HPP_INCLUDED
+
+#include "Model.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+//==============================================
+// TRAJECTORY FILE
+//==============================================
+// [header, one page                             ]
+// [molecule types, one byte each, page-aligned  ]
+// [index, one entry per frame of the capacity   ]
+// [frames, page-aligned, frameBytes apart       ]
+//
+// A frame is the coordinates of every molecule,
+// x, y, z one after another, then the length of
+// every speed, all as PhysVal_t. Frames have the
+// same size, so frame i is at dataOffset + i *
+// frameBytes, the index keeps the step of each.
+// The writer grows the file by chunks of frames
+// and cuts it to the frames in it once done.
+//==============================================
+
+const char     TRAJECTORY_MAGIC[8]  = "GASTRAJ";
+const uint32_t TRAJECTORY_VERSION   = 1;
+const uint64_t TRAJECTORY_PAGE_SIZE = 4096;
+
+const size_t DEFAULT_TRAJECTORY_CAPACITY = 1 << 20;
+// Frames the file grows by when the writer runs out of room:
+const size_t TRAJECTORY_CHUNK_FRAMES = 64;
+
+struct TrajectoryHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerBytes;
+	uint64_t moleculeCount;
+	uint64_t frameBytes;
+	uint64_t frameCapacity;
+	// Frames complete in the file, raised only once a frame and its index entry are written:
+	uint64_t frameCount;
+	uint64_t typesOffset;
+	uint64_t indexOffset;
+	uint64_t dataOffset;
+	PhysVal_t boxSize[3];
+};
+
+struct TrajectoryIndexEntry
+{
+	uint64_t step;
+	uint64_t offset;
+};
+
+// A resumed trajectory keeps the frames from before the model's iteration, the file is created if there is none
+enum TrajectoryOpening
+{
+	CREATE_TRAJECTORY = 0,
+	RESUME_TRAJECTORY = 1
+};
+
+// Frames go straight into a shared mapping of the file, chunk by chunk
+class TrajectoryWriter
+{
+public:
+	TrajectoryWriter(const char* path, const GasModel& model, size_t capacity = DEFAULT_TRAJECTORY_CAPACITY,
+	                 TrajectoryOpening opening = CREATE_TRAJECTORY);
+	// Cuts the file to the frames in it
+	~TrajectoryWriter();
+
+	// The frame is tagged with the iteration of the model
+	void writeFrame(const GasModel& model);
+
+	size_t frameCount() const;
+
+private:
+	void createFile(const char* path, const GasModel& model, size_t capacity);
+	bool resumeFile(const char* path, const GasModel& model);
+	void mapHead(const char* path);
+	void mapChunk(size_t firstFrame);
+	void unmapChunk();
+
+	int fd;
+	size_t moleculeCount;
+
+	// Header, types and index stay mapped all the time:
+	char* head;
+	size_t headBytes;
+	TrajectoryHeader* header;
+	TrajectoryIndexEntry* index;
+
+	// Mapping of frames [chunkFirst, chunkFirst + TRAJECTORY_CHUNK_FRAMES):
+	char* chunk;
+	size_t chunkBytes;
+	char* chunkFrames;
+	size_t chunkFirst;
+};
+
+// Maps the whole file read-only, pointers into it stay valid while the reader lives.
+// Only the pages of the frames actually looked at are ever read from disk.
+class TrajectoryReader
+{
+public:
+	TrajectoryReader(const char* path);
+	~TrajectoryReader();
+
+	size_t frameCount() const;
+	size_t moleculeCount() const;
+	Vector boxSize() const;
+
+	const uint8_t* moleculeTypes() const;
+
+	uint64_t frameStep(size_t frameI) const;
+	// Frames of a range are frameBytes apart, both calls work as the start of one:
+	const PhysVal_t* coords(size_t frameI) const;
+	const PhysVal_t* speeds(size_t frameI) const;
+	size_t frameBytes() const;
+
+	// The first frame at the step or after it, frameCount() if there is none
+	size_t findFrame(uint64_t step) const;
+
+private:
+	int fd;
+	char* data;
+	size_t dataBytes;
+	const TrajectoryHeader* header;
+	const TrajectoryIndexEntry* index;
+	size_t frames;
+};
+
+#endif // GAS_MODEL_TRAJECTORY_HPP_INCLUDED
\ No newline at end of file
@@ -0,0 +1,136 @@
+// No Copyright. Vladislav Aleinik 2019
+#include "Transport.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+SocketTransport::SocketTransport(size_t newRank, const std::vector<int>& newPeers) :
+	myRank   (newRank),
+	peers    (newPeers),
+	children ()
+{}
+
+SocketTransport::~SocketTransport()
+{
+	for (int peer : peers)
+	{
+		if (peer != -1) close(peer);
+	}
+
+	// Ranks forked by forkLocal() are reaped by rank 0:
+	for (pid_t child : children)
+		waitpid(child, nullptr, 0);
+}
+
+SocketTransport* SocketTransport::forkLocal(size_t rankCount)
+{
+	// sockets[a][b] is the end rank a uses to talk to rank b:
+	std::vector<std::vector<int>> sockets(rankCount, std::vector<int>(rankCount, -1));
+
+	for (size_t a = 0; a < rankCount; ++a)
+	{
+		for (size_t b = a + 1; b < rankCount; ++b)
+		{
+			int pair[2];
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1)
+			{
+				printf("SocketTransport::forkLocal(): Unable to create a socket pair!\n");
+				exit(1);
+			}
+
+			sockets[a][b] = pair[0];
+			sockets[b][a] = pair[1];
+		}
+	}
+
+	std::vector<pid_t> children;
+	size_t myRank = 0;
+
+	for (size_t rank = 1; rank < rankCount; ++rank)
+	{
+		pid_t pid = fork();
+		if (pid == -1)
+		{
+			printf("SocketTransport::forkLocal(): Unable to fork!\n");
+			exit(1);
+		}
+
+		if (pid == 0)
+		{
+			myRank = rank;
+			children.clear();
+			break;
+		}
+
+		children.push_back(pid);
+	}
+
+	// Every rank keeps only its own ends:
+	for (size_t a = 0; a < rankCount; ++a)
+	{
+		if (a == myRank) continue;
+
+		for (int socket : sockets[a])
+		{
+			if (socket != -1) close(socket);
+		}
+	}
+
+	SocketTransport* transport = new SocketTransport(myRank, sockets[myRank]);
+	transport->children = children;
+
+	return transport;
+}
+
+size_t SocketTransport::rank() const
+{
+	return myRank;
+}
+
+size_t SocketTransport::rankCount() const
+{
+	return peers.size();
+}
+
+void SocketTransport::send(size_t toRank, const void* data, size_t size)
+{
+	const char* bytes = static_cast<const char*>(data);
+
+	while (size != 0)
+	{
+		ssize_t sent = write(peers[toRank], bytes, size);
+		if (sent == -1 && errno == EINTR) continue;
+		if (sent <= 0)
+		{
+			printf("SocketTransport::send(): Rank %zu is unable to send to rank %zu!\n", myRank, toRank);
+			exit(1);
+		}
+
+		bytes += sent;
+		size  -= sent;
+	}
+}
+
+void SocketTransport::receive(size_t fromRank, void* data, size_t size)
+{
+	char* bytes = static_cast<char*>(data);
+
+	while (size != 0)
+	{
+		ssize_t received = read(peers[fromRank], bytes, size);
+		if (received == -1 && errno == EINTR) continue;
+		if (received <= 0)
+		{
+			printf("SocketTransport::receive(): Rank %zu is unable to receive from rank %zu!\n", myRank, fromRank);
+			exit(1);
+		}
+
+		bytes += received;
+		size  -= received;
+	}
+}
@@ -0,0 +1,47 @@
+// No Copyright. Vladislav Aleinik 2019
+#ifndef GAS_MODEL_TRANSPORT_HPP_INCLUDED
+#define GAS_MODEL_TRANSPORT_HPP_INCLUDED
+
+#include <cstddef>
+#include <sys/types.h>
+#include <vector>
+
+// Point-to-point messages between the ranks of a decomposed model.
+// Both calls block until the whole message is through.
+class Transport
+{
+public:
+	virtual ~Transport() = default;
+
+	virtual size_t rank() const = 0;
+	virtual size_t rankCount() const = 0;
+
+	virtual void send(size_t toRank, const void* data, size_t size) = 0;
+	virtual void receive(size_t fromRank, void* data, size_t size) = 0;
+};
+
+// Ranks talk over stream sockets, one per pair of ranks
+class SocketTransport : public Transport
+{
+public:
+	// Descriptor of the socket to every other rank, -1 for the rank itself
+	SocketTransport(size_t newRank, const std::vector<int>& newPeers);
+	~SocketTransport();
+
+	// Forks rankCount - 1 processes connected by socket pairs, all ranks return from here.
+	// Has to run before threads are started. Rank 0 is the calling process and waits for the rest.
+	static SocketTransport* forkLocal(size_t rankCount);
+
+	size_t rank() const override;
+	size_t rankCount() const override;
+
+	void send(size_t toRank, const void* data, size_t size) override;
+	void receive(size_t fromRank, void* data, size_t size) override;
+
+private:
+	size_t myRank;
+	std::vector<int> peers;
+	std::vector<pid_t> children;
+};
+
+#endif  // GAS_MODEL_TRANSPORT_HPP_INCLUDED
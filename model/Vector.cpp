@@ -97,7 +97,7 @@ inline PhysVal_t Vector::scalar(const Vector& v) const
 
 const __m256d FLOATING_POINT_SIGN = _mm256_set1_pd(-0.0);
 
-// It is written solely for <collide/attract>OneMoleculeBarnesHut - the bottleneck
+// It is written solely for forEachTreeNeighbor - the bottleneck
 inline bool Vector::isInBox(Vector boxSize) const
 {
 	Vector absoluteValue;
@@ -39,7 +39,7 @@ union Vector
 
 	inline PhysVal_t scalar(const Vector& v) const;
 
-	// It is written solely for <collide/attract>OneMoleculeBarnesHut - the bottleneck
+	// It is written solely for forEachTreeNeighbor - the bottleneck
 	inline bool isInBox(Vector boxSize) const;
 };
 
@@ -1,16 +1,50 @@
 // No Copyright. Vladislav Aleinik 2019
 #include "Walls.hpp"
 
+#include <cmath>
+#include <limits>
+
 GasContainer::GasContainer(Vector boxSize) :
-	containerSize (boxSize)
+	containerSize (boxSize),
+	period        (std::numeric_limits<PhysVal_t>::infinity(),
+	               std::numeric_limits<PhysVal_t>::infinity(),
+	               std::numeric_limits<PhysVal_t>::infinity())
 {}
 
-void GasContainer::moleculeBounce(Molecule& mol)
+void GasContainer::setBoundary(size_t axis, Boundary boundary)
+{
+	PhysVal_t  sizes[3]   = {containerSize.x, containerSize.y, containerSize.z};
+	PhysVal_t* periods[3] = {&period.x, &period.y, &period.z};
+
+	*periods[axis] = (boundary == PERIODIC_BOUNDARY)? sizes[axis] : std::numeric_limits<PhysVal_t>::infinity();
+}
+
+Boundary GasContainer::getBoundary(size_t axis) const
+{
+	PhysVal_t periods[3] = {period.x, period.y, period.z};
+
+	return std::isfinite(periods[axis])? PERIODIC_BOUNDARY : REFLECTING_WALLS;
+}
+
+bool GasContainer::isPeriodic() const
+{
+	return std::isfinite(period.x) || std::isfinite(period.y) || std::isfinite(period.z);
+}
+
+// Wraps a coordinate that left [0, size) by less than a period
+inline void wrapCoordinate(PhysVal_t& coord, PhysVal_t size)
+{
+	if      (coord <  0.0)  coord += size;
+	else if (coord >= size) coord -= size;
+}
+
+void GasContainer::moleculeBounce(Molecule& mol) const
 {
 	Vector cur = mol.coords;
 	PhysVal_t radius = COLLISION_RADIUS[mol.type];
 
-	if (cur.x < radius)
+	if (std::isfinite(period.x)) wrapCoordinate(cur.x, containerSize.x);
+	else if (cur.x < radius)
 	{
 		cur.x = 2 * radius - cur.x;
 		mol.speed.x *= -1;
@@ -21,7 +55,8 @@ void GasContainer::moleculeBounce(Molecule& mol)
 		mol.speed.x *= -1;
 	}
 
-	if (cur.y < radius)
+	if (std::isfinite(period.y)) wrapCoordinate(cur.y, containerSize.y);
+	else if (cur.y < radius)
 	{
 		cur.y = 2 * radius - cur.y;
 		mol.speed.y *= -1;
@@ -32,7 +67,8 @@ void GasContainer::moleculeBounce(Molecule& mol)
 		mol.speed.y *= -1;
 	}
 
-	if (cur.z < radius)
+	if (std::isfinite(period.z)) wrapCoordinate(cur.z, containerSize.z);
+	else if (cur.z < radius)
 	{
 		cur.z = 2 * radius - cur.z;
 		mol.speed.z *= -1;
@@ -4,14 +4,29 @@
 
 #include "Molecule.hpp"
 
+// Every axis either has two reflecting walls or wraps around
+enum Boundary
+{
+	REFLECTING_WALLS  = 0,
+	PERIODIC_BOUNDARY = 1
+};
+
 class GasContainer
 {
 public:
 	Vector containerSize;
 
+	// Container size along periodic axes, infinity along walls, see nearestImage():
+	Vector period;
+
 	GasContainer(Vector boxSize);
 
-	void moleculeBounce(Molecule& mol);
+	void setBoundary(size_t axis, Boundary boundary);
+	Boundary getBoundary(size_t axis) const;
+	bool isPeriodic() const;
+
+	// Reflects off the walls and wraps around periodic axes
+	void moleculeBounce(Molecule& mol) const;
 };
 
 #endif  // GAS_MODEL_WALLS_HPP_INCLUDED
\ No newline at end of file
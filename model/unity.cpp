@@ -1,7 +1,18 @@
+#include "CellList.cpp"
+#include "CollisionEvents.cpp"
 #include "Dimensioning.cpp"
+#include "Domain.cpp"
+#include "LennardJonesTable.cpp"
 #include "Model.cpp"
 #include "Molecule.cpp"
+#include "MoleculeArrays.cpp"
 #include "MoleculeTypes.cpp"
+#include "Multipole.cpp"
+#include "NeighborList.cpp"
+#include "Observers.cpp"
 #include "SavingToFile.cpp"
+#include "Threading.cpp"
+#include "Trajectory.cpp"
+#include "Transport.cpp"
 #include "Vector.cpp"
 #include "Walls.cpp"
\ No newline at end of file
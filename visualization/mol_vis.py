@@ -1,6 +1,8 @@
 # Run this bad boy in interative mode
 
+import os
 import sys
+import zlib
 import argparse
 
 import vispy
@@ -9,11 +11,97 @@ import numpy as np
 
 COLORS_ENUM = [(0.4, 0.4, 1), (1, 1, 0)]
 
+# Layout of model/Trajectory.hpp
+TRAJ_MAGIC = b'GASTRAJ'
+TRAJ_VERSION = 1
+TRAJ_HEADER = np.dtype([('magic', 'S8'), ('version', '<u4'), ('header_bytes', '<u4'),
+                        ('molecule_count', '<u8'), ('frame_bytes', '<u8'), ('frame_capacity', '<u8'),
+                        ('frame_count', '<u8'), ('types_offset', '<u8'), ('index_offset', '<u8'),
+                        ('data_offset', '<u8'), ('box_size', '<f8', (3,))])
+TRAJ_INDEX = np.dtype([('step', '<u8'), ('offset', '<u8')])
+
+def load_trajectory(path):
+    """Maps a trajectory file, frames are only read when they are looked at."""
+    header = np.fromfile(path, dtype=TRAJ_HEADER, count=1)[0]
+    if header['magic'] != TRAJ_MAGIC or header['version'] != TRAJ_VERSION:
+        raise Exception('%s is not a version %d trajectory' % (path, TRAJ_VERSION))
+
+    n = int(header['molecule_count'])
+    frame = np.dtype([('coords', '<f8', (n, 3)), ('speeds', '<f8', (n,))])
+
+    # A file still being written may be longer than its complete frames
+    file_frames = (os.path.getsize(path) - int(header['data_offset'])) // frame.itemsize
+    count = min(int(header['frame_count']), file_frames)
+    if count == 0:
+        raise Exception('No frames in %s' % path)
+
+    types  = np.memmap(path, dtype=np.uint8, mode='r', offset=int(header['types_offset']), shape=(n,))
+    index  = np.memmap(path, dtype=TRAJ_INDEX, mode='r', offset=int(header['index_offset']), shape=(count,))
+    frames = np.memmap(path, dtype=frame, mode='r', offset=int(header['data_offset']), shape=(count,))
+
+    return frames['coords'], frames['speeds'], types, index['step']
+
+# Layout of COMPRESSED_FRAMES in model/SavingToFile.hpp
+QUANT_MAGIC = b'GASQNT'
+QUANT_VERSION = 1
+QUANT_STREAM = np.dtype([('magic', 'S8'), ('version', '<u4'), ('bits', '<u4'),
+                         ('molecule_count', '<u8'), ('components', '<u8')])
+QUANT_FRAME = np.dtype([('keyframe', '<u4'), ('packed_bytes', '<u4'), ('scales', '<f8', (3,))])
+
+def load_quantized(path):
+    """Decodes every frame of a compressed stream, shaped as the .npy of raw frames."""
+    with open(path, 'rb') as stream:
+        data = stream.read()
+
+    header = np.frombuffer(data, dtype=QUANT_STREAM, count=1)[0]
+    if header['magic'] != QUANT_MAGIC or header['version'] != QUANT_VERSION:
+        raise Exception('%s is not a version %d frame stream' % (path, QUANT_VERSION))
+
+    n = int(header['molecule_count'])
+    components = int(header['components'])
+    top = (1 << int(header['bits'])) - 1
+
+    prev = np.zeros((components, n), dtype=np.uint16)
+    frames = []
+
+    pos = QUANT_STREAM.itemsize
+    while pos + QUANT_FRAME.itemsize <= len(data):
+        frame = np.frombuffer(data, dtype=QUANT_FRAME, count=1, offset=pos)[0]
+        pos += QUANT_FRAME.itemsize
+
+        packed = data[pos:pos + int(frame['packed_bytes'])]
+        pos += int(frame['packed_bytes'])
+
+        planes = np.frombuffer(zlib.decompress(packed), dtype=np.uint8).reshape(components, 2, n).astype(np.uint16)
+        codes = planes[:, 0] | (planes[:, 1] << 8)
+
+        # Steps are zigzag-coded and wrap around modulo 2^16
+        if frame['keyframe']:
+            prev = codes
+        else:
+            prev = prev + ((codes >> 1) ^ -(codes & 1))
+
+        values = prev.T * (frame['scales'][:components] / top)
+        frames.append(values if components == 3 else values[:, 0])
+
+    return np.array(frames)
+
+def load_frames(path):
+    """Maps a raw .npy of frames or decodes a compressed stream."""
+    with open(path, 'rb') as stream:
+        magic = stream.read(QUANT_STREAM['magic'].itemsize)
+
+    if magic.rstrip(b'\0') == QUANT_MAGIC:
+        return load_quantized(path)
+
+    return np.load(path, mmap_mode='r')
+
 class ColorSetter:
     def __init__(self, colors, cm=None):
         if len(colors.shape) == 2:
             self.each_f = True
             self.colors = colors
+            self.scale = colors.max()
         else:
             self.each_f = False
             self.colors = np.array(list(map(lambda x: COLORS_ENUM[int(x)], colors)))
@@ -21,13 +109,14 @@ class ColorSetter:
 
     def __getitem__(self, i):
         if self.each_f:
-            return self.cm.map(self.colors[i])
+            return self.cm.map(self.colors[i] / self.scale)
         else:
             return self.colors
 
 class Updater:
-    def __init__(self, frames, color_setter, sizes, points):
+    def __init__(self, frames, shift, color_setter, sizes, points):
         self.frames = frames
+        self.shift = shift
         self.color_setter = color_setter
         self.points = points
         self.i = 1
@@ -35,7 +124,7 @@ class Updater:
 
     def update(self, koeff):
         try:
-            self.points.set_data(self.frames[self.i], 
+            self.points.set_data(self.frames[self.i] - self.shift,
                                  face_color     = self.color_setter[self.i],
                                  size           = self.sizes*koeff,
                                  edge_width     = None,
@@ -58,9 +147,12 @@ if __name__ == '__main__':
 
     parser = argparse.ArgumentParser()
 
-    parser.add_argument('frames', help='NumPy array of points coordinates.')
-    parser.add_argument('colors', help='NumPy array of points velocities.')
-    parser.add_argument('types', help='NumPy array of points velocities.')
+    parser.add_argument('frames', help='Trajectory file, NumPy array or compressed stream of points coordinates.')
+    parser.add_argument('colors', nargs='?', help='NumPy array or compressed stream of points velocities.')
+    parser.add_argument('types', nargs='?', help='NumPy array of points types.')
+    parser.add_argument('--first', default=0, type=int, help='First frame to show.')
+    parser.add_argument('--last', default=None, type=int, help='Frame to stop before.')
+    parser.add_argument('--fromstep', default=None, type=int, help='Start at the first frame of the step or after.')
     parser.add_argument('--fps', default=20, type=int)
     parser.add_argument('-r', '--realtime', default=True, type=int)
     parser.add_argument('-t', '--showtemp', default=True, type=int)
@@ -70,17 +162,28 @@ if __name__ == '__main__':
 
     args = parser.parse_args()
 
-    if (args.frames is None) or (args.colors is None) or (args.types is None):
+    # Load and transform data
+
+    if args.frames.endswith('.traj'):
+        frames, colors, types, steps = load_trajectory(args.frames)
+
+        if args.fromstep is not None:
+            args.first = int(np.searchsorted(steps, args.fromstep))
+    elif (args.colors is None) or (args.types is None):
         raise Exception('No files provided')
+    else:
+        frames = load_frames( args.frames )
+        colors = load_frames( args.colors )
+        types = np.load( args.types )
 
-    # Load and transform data
+    # Slices of mapped arrays are views, nothing before the first frame is read
+    frames = frames[args.first:args.last]
+    colors = colors[args.first:args.last]
+    if frames.shape[0] == 0:
+        raise Exception('No frames in the range')
 
-    frames = np.load( args.frames )
-    colors = np.load( args.colors )
-    types = np.load( args.types )
     sizes = np.array([get_size(x) for x in types])
 
-    colors /= colors.max()
     cm = vispy.color.Colormap(['lightblue', 'lightgreen', 'lightyellow', 'orange', 'red'], [0, 0.1, 0.3, 0.4, 1])
 
     if args.showtemp:
@@ -96,15 +199,15 @@ if __name__ == '__main__':
     view = win.central_widget.add_view()
     view.camera = 'arcball'
 
-    coor_rang = np.abs(frames).max() * 1
+    coor_rang = np.abs(frames[0]).max() * 1
     view.camera.set_range(x=[-coor_rang, coor_rang], y=[-coor_rang, coor_rang], z=[-coor_rang, coor_rang])
 
     # Real thing
     x_m, y_m, z_m = list(map(int, args.cubesize.split("x")))
-    frames -= np.array([x_m/2, y_m/2, z_m/2])
-    
+    shift = np.array([x_m/2, y_m/2, z_m/2])
+
     molecules = scene.visuals.Markers(parent=view.scene)
-    molecules.set_data(frames[0], face_color=color_setter[0], size=sizes)
+    molecules.set_data(frames[0] - shift, face_color=color_setter[0], size=sizes)
 
     borders = scene.visuals.Cube((x_m/2, y_m/2, z_m/2), color=[0.1, 0.1, 0.1, 0.1],
                                edge_color='black', parent=view.scene)
@@ -114,7 +217,7 @@ if __name__ == '__main__':
 
         molecules.events.update.connect(lambda evt: win.update)
 
-        upd = Updater(frames, color_setter, sizes, molecules)
+        upd = Updater(frames, shift, color_setter, sizes, molecules)
 
         timer = vispy.app.Timer()
         timer.connect(lambda ev: upd.update(args.koeff * 1650 / view.camera.scale_factor))
@@ -138,6 +241,6 @@ if __name__ == '__main__':
 
             view.camera.transform.rotate(args.rotateangle, axis)
 
-            molecules.set_data(frames[i], face_color=color_setter[i], size=sizes)
+            molecules.set_data(frames[i] - shift, face_color=color_setter[i], size=sizes)
 
         writer.close()